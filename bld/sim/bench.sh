@@ -0,0 +1,127 @@
+#!/bin/sh
+#
+# Run the app in the mspdebug simulator until it reaches task_done and report
+# the cost in MSP430 cycles per sample and per task, and the number of
+# writes to FRAM, with a breakdown of the cycles by task type.
+#
+# The cycle count and the bus writes come from the simulator's tracer device;
+# the sample, task and block counts, and the cycles per task type, come from
+# the app's 'bench' struct (built with CONFIG_SIM_BENCH), which the app fills
+# in from Timer_A0 (simulated by the timer device). The cycles of the
+# accounting itself, which the app measures at boot, are taken out of each
+# task's cycles and listed on their own.
+#
+# Usage: bench.sh [templog.out]
+
+EXEC=${1:-templog.out}
+SRC=${SRC:-$(dirname "$0")/../../src/main.c}
+
+# Layout of the bench struct in src/main.c
+BENCH_MAX_TASKS=16
+BENCH_SIZE=144
+
+# FRAM address range on MSP430FR5969 (main memory, excluding the vectors)
+FRAM_START=${FRAM_START:-0x4400}
+FRAM_END=${FRAM_END:-0xff7f}
+
+mspdebug -q sim \
+    "simio add tracer trace" \
+    "simio config trace verbose" \
+    "simio add timer timer0" \
+    "simio config timer0 base 0x340" \
+    "prog $EXEC" \
+    "setbreak task_done" \
+    "run" \
+    "simio info trace" \
+    "md bench $BENCH_SIZE" |
+awk -v fram_start=$(printf "%d" $FRAM_START) \
+    -v fram_end=$(printf "%d" $FRAM_END) \
+    -v max_tasks=$BENCH_MAX_TASKS -v bench_size=$BENCH_SIZE \
+    -v src="$SRC" '
+BEGIN { # task names by index, from the TASK(idx, name) declarations
+    while ((getline line < src) > 0)
+        if (match(line, /^TASK\( *[0-9]+, *[a-zA-Z_0-9]+\)/)) {
+            split(substr(line, RSTART + 5, RLENGTH - 6), f, /, */)
+            task_name[f[1] + 0] = f[2]
+        }
+    task_name[0] = "(boot)"
+}
+function hex(s,    i, c, v) {
+    sub(/^0x/, "", s); s = tolower(s); v = 0
+    for (i = 1; i <= length(s); ++i) {
+        c = index("0123456789abcdef", substr(s, i, 1))
+        if (c == 0) return -1
+        v = v * 16 + c - 1
+    }
+    return v
+}
+function le(off, len,    i, v) { # little-endian integer from dumped bytes
+    v = 0
+    for (i = len - 1; i >= 0; --i) v = v * 256 + hex(bytes[off + i])
+    return v
+}
+/write/ {
+    write_lines++
+    for (i = 1; i <= NF; ++i) {
+        addr = hex($i)
+        if ($i ~ /^(0x)?[0-9a-fA-F]+$/ && addr >= 0) {
+            if (addr >= fram_start && addr <= fram_end)
+                fram_writes++
+            break
+        }
+    }
+    next
+}
+/[Cc]ycle/ { cycles = $NF }
+/^ *[0-9a-fA-F]+:/ && !dumped { # md output: "addr: b0 b1 ... |ascii|"
+    for (i = 2; i <= NF && $i !~ /^\|/ && nbytes < bench_size; ++i)
+        if ($i ~ /^[0-9a-fA-F][0-9a-fA-F]$/) bytes[nbytes++] = $i
+    if (nbytes >= bench_size) dumped = 1
+}
+END {
+    if (!dumped || cycles == "") {
+        print "bench: failed to read counters from the simulator" > "/dev/stderr"
+        exit 1
+    }
+    # The app writes its channels to FRAM all the time: none found means
+    # that the tracer output was not understood
+    if (!write_lines || !fram_writes) {
+        printf "bench: no %s in the tracer output\n",
+               write_lines ? "writes to FRAM" : "bus writes" > "/dev/stderr"
+        exit 1
+    }
+    samples = le(0, 4); tasks = le(4, 4)
+    blocks = le(8 + 8 * max_tasks, 2)
+    overhead = le(8 + 8 * max_tasks + 6, 2)
+    printf "blocks:            %u\n", blocks
+    printf "samples:           %u\n", samples
+    printf "tasks:             %u\n", tasks
+    printf "cycles:            %u\n", cycles
+    printf "FRAM writes:       %u\n", fram_writes
+    if (samples > 0) {
+        printf "cycles/sample:     %.1f\n", cycles / samples
+        printf "FRAM writes/sample: %.1f\n", fram_writes / samples
+    }
+    if (tasks > 0)
+        printf "cycles/task:       %.1f\n", cycles / tasks
+
+    printf "\n%-22s %8s %12s %10s %6s\n", "task", "runs", "cycles",
+           "cycles/run", "%"
+    timed = 0
+    for (t = 0; t < max_tasks; ++t) {
+        runs = le(8 + 4 * t, 4); task_cycles = le(8 + 4 * (max_tasks + t), 4)
+        timed += task_cycles
+        task_cycles -= runs * overhead
+        if (!runs && !task_cycles) continue
+        name = (t in task_name) ? task_name[t] : ("task " t)
+        printf "%-22s %8u %12u %10.1f %6.1f\n", name, runs, task_cycles,
+               runs ? task_cycles / runs : 0,
+               cycles ? 100 * task_cycles / cycles : 0
+    }
+    printf "%-22s %8u %12u %10u %6.1f\n", "(accounting)", tasks,
+           tasks * overhead, overhead,
+           cycles ? 100 * tasks * overhead / cycles : 0
+    # Not timed: the last task before the breakpoint
+    printf "%-22s %8s %12d %10s %6.1f\n", "(other)", "", cycles - timed, "",
+           cycles ? 100 * (cycles - timed) / cycles : 0
+}'
@@ -0,0 +1,291 @@
+// Energy model for the host build: the storage capacitor of the device,
+// charged by the harvester according to a power profile and drained by the
+// MCU, whose cost per task is estimated from the work the task did. Also
+// implements the energy interface of the app (src/energy.h) on top of it.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "energy.h"
+#include "model.h"
+
+// Cycle estimates for the work done by a task
+#define TASK_CYCLES            400 // transition and commit in libchain
+#define READ_CYCLES             60 // scan the channels for the latest field
+#define WRITE_BYTE_CYCLES        4 // FRAM write
+#define PRINT_BYTE_CYCLES      694 // 115200 baud UART at 8 MHz
+#define ADC_CYCLES            1000 // reference settling and conversion
+#define BOOT_CYCLES          20000 // reset, C runtime, board init
+
+struct segment {
+    double end;                 // time (s)
+    double power;               // W
+};
+
+static struct model_params params;
+static struct segment *segments;
+static unsigned num_segments, cur_segment;
+
+static double energy;           // stored (J)
+static double e_max, e_on, e_off;
+static double now;              // s
+
+// The current task: its ADC reads, the part of its work already charged (at
+// a sleep), and the energy it drew, which is wasted if it does not complete
+static unsigned long task_adc_reads;
+static struct task_cost task_charged;
+static unsigned long task_charged_adc_reads;
+static double task_drawn;
+
+static struct {
+    double harvested;           // offered by the harvester
+    double used;                // by completed tasks, boots and sleep
+    double wasted;              // by tasks that did not complete
+    unsigned long boots;
+    unsigned long failures;
+    unsigned long sleeps;
+} totals;
+
+void model_defaults(struct model_params *p)
+{
+    p->profile = NULL;
+    p->power = 0;
+    p->duration = 60;
+    p->capacitance = 100e-6;
+    p->v_max = 2.5;
+    p->v_on = 2.4;
+    p->v_off = 1.8;
+    p->clock = 8e6;
+    p->cycle_energy = 0.25e-9;  // ~1 mA at 2 V and 8 MHz
+    p->sleep_power = 2e-6;      // LPM3
+    p->sleep_time = 0.05;       // watchdog interval (see src/energy.c)
+}
+
+static int add_segment(double duration, double power)
+{
+    struct segment *s = realloc(segments, (num_segments + 1) * sizeof(*s));
+
+    if (!s)
+        return -1;
+    segments = s;
+    segments[num_segments].end =
+        (num_segments ? segments[num_segments - 1].end : 0) + duration;
+    segments[num_segments].power = power;
+    num_segments++;
+    return 0;
+}
+
+static int load_profile(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    char line[256];
+    double duration, power;
+
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == '#' || sscanf(line, "%lf %lf", &duration, &power) != 2)
+            continue;
+        if (add_segment(duration, power)) {
+            fclose(f);
+            return -1;
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+static double cap_energy(double v)
+{
+    return params.capacitance * v * v / 2;
+}
+
+int model_init(const struct model_params *p)
+{
+    params = *p;
+
+    if (params.profile) {
+        if (load_profile(params.profile))
+            return -1;
+        if (!num_segments) {
+            fprintf(stderr, "%s: empty profile\n", params.profile);
+            return -1;
+        }
+    } else if (params.power > 0) {
+        if (add_segment(params.duration, params.power))
+            return -1;
+    }
+
+    if (!(params.v_off < params.v_on && params.v_on <= params.v_max)) {
+        fprintf(stderr, "voltages must be: off < on <= max\n");
+        return -1;
+    }
+    e_max = cap_energy(params.v_max);
+    e_on = cap_energy(params.v_on);
+    e_off = cap_energy(params.v_off);
+    energy = 0;
+    return 0;
+}
+
+bool model_enabled()
+{
+    return num_segments > 0;
+}
+
+bool model_finished()
+{
+    if (!model_enabled()) // continuous power, for the given duration
+        return now >= params.duration;
+    return cur_segment == num_segments;
+}
+
+// Advance time by 'dt' with the given load on the capacitor, adding the
+// energy drawn to 'drawn'. Returns false if the capacitor dropped to the
+// brown-out level (time advances up to that point). With 'until_on', charge
+// until the power-on level instead, false if the profile ends first.
+static bool advance(double dt, double load, bool until_on, double *drawn)
+{
+    while ((until_on || dt > 0) && cur_segment < num_segments) {
+        struct segment *seg = &segments[cur_segment];
+        double step = seg->end - now;
+        double net = seg->power - load;
+
+        if (!until_on && step > dt)
+            step = dt;
+
+        if (until_on && net > 0 && energy + net * step >= e_on) {
+            step = (e_on - energy) / net;
+        } else if (!until_on && net < 0 && energy + net * step < e_off) {
+            step = (energy - e_off) / -net;
+            now += step;
+            totals.harvested += seg->power * step;
+            *drawn += load * step;
+            energy = e_off;
+            return false;
+        }
+
+        now += step;
+        dt -= step;
+        totals.harvested += seg->power * step;
+        *drawn += load * step;
+        energy += net * step;
+        if (energy > e_max)
+            energy = e_max;
+
+        if (now >= seg->end)
+            cur_segment++;
+        if (until_on && energy >= e_on)
+            return true;
+    }
+    return !until_on;
+}
+
+static double active_power()
+{
+    return params.cycle_energy * params.clock;
+}
+
+bool model_power_on()
+{
+    double drawn = 0;
+
+    if (!model_enabled())
+        return true;
+
+    if (!advance(0, 0, true, &drawn))
+        return false; // profile ended before the capacitor charged up
+
+    totals.boots++;
+    advance(BOOT_CYCLES / params.clock, active_power(), false, &drawn);
+    totals.used += drawn;
+    return !model_finished();
+}
+
+// Run the current task for the cycles of the work it did since the last
+// charge, false if power failed before the end
+static bool task_charge(const struct task_cost *cost, unsigned long cycles)
+{
+    cycles += (cost->reads - task_charged.reads) * READ_CYCLES +
+              (cost->bytes_written - task_charged.bytes_written) *
+              WRITE_BYTE_CYCLES +
+              (cost->bytes_printed - task_charged.bytes_printed) *
+              PRINT_BYTE_CYCLES +
+              (task_adc_reads - task_charged_adc_reads) * ADC_CYCLES;
+    task_charged = *cost;
+    task_charged_adc_reads = task_adc_reads;
+
+    if (!model_enabled()) {
+        now += cycles / params.clock;
+        return true;
+    }
+    return advance(cycles / params.clock, active_power(), false, &task_drawn);
+}
+
+static void task_reset()
+{
+    memset(&task_charged, 0, sizeof(task_charged));
+    task_charged_adc_reads = 0;
+    task_adc_reads = 0;
+    task_drawn = 0;
+}
+
+bool model_run_task(const struct task_cost *cost)
+{
+    if (!task_charge(cost, TASK_CYCLES))
+        return false; // see model_task_failed
+    totals.used += task_drawn;
+    task_reset();
+    return true;
+}
+
+void model_task_failed()
+{
+    totals.wasted += task_drawn;
+    totals.failures++;
+    task_reset();
+}
+
+uint16_t energy_level()
+{
+    task_adc_reads++;
+    if (!model_enabled())
+        return params.v_max * 1000;
+    return sqrt(2 * energy / params.capacitance) * 1000;
+}
+
+void energy_sleep()
+{
+    // The capacitor level after the sleep reflects the work before it
+    if (!task_charge(chain_task_cost(), 0))
+        chain_power_fail();
+
+    if (!model_enabled()) {
+        now += params.sleep_time;
+        return;
+    }
+
+    totals.sleeps++;
+    if (!advance(params.sleep_time, params.sleep_power, false, &task_drawn))
+        chain_power_fail();
+}
+
+void model_report(unsigned long samples)
+{
+    if (!model_enabled()) {
+        fprintf(stderr, "time: %.3f s\n", now);
+        fprintf(stderr, "samples: %lu (continuous power)\n", samples);
+        return;
+    }
+
+    fprintf(stderr, "time: %.3f s\n", now);
+    fprintf(stderr, "energy: harvested %.6f J, used %.6f J, wasted %.6f J\n",
+            totals.harvested, totals.used, totals.wasted);
+    fprintf(stderr, "boots: %lu, power failures: %lu, sleeps: %lu\n",
+            totals.boots, totals.failures, totals.sleeps);
+    fprintf(stderr, "samples: %lu, samples/J: %.1f\n", samples,
+            totals.harvested > 0 ? samples / totals.harvested : 0);
+}
@@ -0,0 +1,101 @@
+#ifndef HOST_LIBCHAIN_CHAIN_H
+#define HOST_LIBCHAIN_CHAIN_H
+
+// Host implementation of the libchain interface used by the app.
+//
+// A channel is a struct of fields, each with the timestamp of its last
+// write; reading from several channels returns the most recently written
+// value, as on the device. Self channels and multicast channels are single
+// buffers. The writes of a task are undone if power fails before it
+// completes (see host/runtime.c), which stands in for the re-execution
+// semantics on the device.
+
+#include <stddef.h>
+
+// As in libchain, which keeps the self channel fields written by a task in a
+// fixed array without a bounds check: the host build exits instead.
+#define MAX_DIRTY_SELF_FIELDS 4
+
+typedef unsigned long chain_time_t;
+typedef void (task_func_t)(void);
+
+typedef struct {
+    unsigned idx;
+    const char *name;
+    task_func_t *func;
+} task_t;
+
+typedef struct {
+    task_t *task;
+} context_t;
+
+extern context_t * volatile curctx;
+
+void chain_register_task(unsigned idx, const char *name, task_func_t *func);
+void chain_transition(task_func_t *next);
+void chain_write(void *dest, const void *val, size_t size, chain_time_t *ts);
+void *chain_read(size_t count, ...);
+void chain_self_write(void);
+
+#define TASK(idx, func) \
+    void func(); \
+    static void __attribute__ ((constructor)) _register_ ## func(void) { \
+        chain_register_task(idx, #func, func); \
+    }
+
+#define ENTRY_TASK(task) task_func_t *chain_entry_task = task;
+#define INIT_FUNC(func) void (*chain_init_func)() = func;
+
+#define CHAN_FIELD(type, name) \
+    struct { type value; chain_time_t timestamp; } name
+#define CHAN_FIELD_ARRAY(type, name, size) \
+    struct { type value; chain_time_t timestamp; } name[size]
+#define SELF_CHAN_FIELD(type, name) CHAN_FIELD(type, name)
+#define SELF_CHAN_FIELD_ARRAY(type, name, size) CHAN_FIELD_ARRAY(type, name, size)
+#define SELF_FIELD_INITIALIZER
+
+#define CHANNEL(src, dest, type) struct type _ch_ ## src ## _ ## dest
+#define SELF_CHANNEL(task, type) struct type _ch_ ## task ## _ ## task
+#define MULTICAST_CHANNEL(type, name, src, ...) struct type _ch_mc_ ## name
+
+#define CH(src, dest) (&_ch_ ## src ## _ ## dest)
+#define SELF_IN_CH(task) CH(task, task)
+#define SELF_OUT_CH(task) (chain_self_write(), CH(task, task))
+#define MC_IN_CH(name, src, dest) (&_ch_mc_ ## name)
+#define MC_OUT_CH(name, src, ...) (&_ch_mc_ ## name)
+
+#define CHAN_SRC(field, ch) &(ch)->field.value, &(ch)->field.timestamp
+
+#define CHAN_IN1(type, field, ch0) \
+    ((type *)chain_read(1, CHAN_SRC(field, ch0)))
+#define CHAN_IN2(type, field, ch0, ch1) \
+    ((type *)chain_read(2, CHAN_SRC(field, ch0), CHAN_SRC(field, ch1)))
+#define CHAN_IN3(type, field, ch0, ch1, ch2) \
+    ((type *)chain_read(3, CHAN_SRC(field, ch0), CHAN_SRC(field, ch1), \
+                        CHAN_SRC(field, ch2)))
+
+#define CHAN_WRITE(type, field, val, ch) do { \
+        type _val = (val); \
+        __typeof__(ch) _ch = (ch); \
+        chain_write(&_ch->field.value, &_val, sizeof(_val), \
+                    &_ch->field.timestamp); \
+    } while (0)
+
+#define CHAN_OUT1(type, field, val, ch0) \
+    CHAN_WRITE(type, field, val, ch0)
+#define CHAN_OUT2(type, field, val, ch0, ch1) do { \
+        CHAN_WRITE(type, field, val, ch0); \
+        CHAN_WRITE(type, field, val, ch1); \
+    } while (0)
+#define CHAN_OUT3(type, field, val, ch0, ch1, ch2) do { \
+        CHAN_WRITE(type, field, val, ch0); \
+        CHAN_WRITE(type, field, val, ch1); \
+        CHAN_WRITE(type, field, val, ch2); \
+    } while (0)
+
+#define TRANSITION_TO(task) do { \
+        chain_transition(task); \
+        return; \
+    } while (0)
+
+#endif // HOST_LIBCHAIN_CHAIN_H
@@ -0,0 +1,19 @@
+#ifndef HOST_LIBIO_LOG_H
+#define HOST_LIBIO_LOG_H
+
+// Console output of the app, buffered by the runtime until the task
+// completes (see host/runtime.c)
+
+int chain_printf(const char *fmt, ...)
+    __attribute__ ((format (printf, 1, 2)));
+
+#define INIT_CONSOLE()
+
+#define LOG(...)
+#define PRINTF(...) chain_printf(__VA_ARGS__)
+#define EIF_PRINTF(...)
+#define BLOCK_PRINTF(...) chain_printf(__VA_ARGS__)
+#define BLOCK_PRINTF_BEGIN()
+#define BLOCK_PRINTF_END()
+
+#endif // HOST_LIBIO_LOG_H
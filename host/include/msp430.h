@@ -0,0 +1,31 @@
+#ifndef HOST_MSP430_H
+#define HOST_MSP430_H
+
+// Registers and bits used by the app, as plain variables on the host
+
+#include <stdint.h>
+
+extern volatile uint16_t P1DIR, P1OUT, P4DIR, P4OUT, PJDIR, PJOUT;
+extern volatile uint16_t ADC12CTL0, ADC12CTL1, ADC12CTL3;
+extern volatile uint16_t ADC12MCTL0, ADC12MEM0;
+
+#define BIT0            0x0001
+#define BIT1            0x0002
+#define BIT2            0x0004
+#define BIT4            0x0010
+#define BIT5            0x0020
+#define BIT6            0x0040
+
+#define ADC12SC         0x0001
+#define ADC12ENC        0x0002
+#define ADC12ON         0x0010
+#define ADC12SHT0_2     0x0200
+#define ADC12BUSY       0x0001
+#define ADC12CONSEQ_0   0x0000
+#define ADC12SHP        0x0200
+#define ADC12TCMAP      0x4000
+#define ADC12INCH_30    0x001E
+
+#define __enable_interrupt()
+
+#endif // HOST_MSP430_H
@@ -0,0 +1,6 @@
+#ifndef HOST_WISP_BASE_H
+#define HOST_WISP_BASE_H
+
+#define WISP_init()
+
+#endif // HOST_WISP_BASE_H
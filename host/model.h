@@ -0,0 +1,58 @@
+#ifndef HOST_MODEL_H
+#define HOST_MODEL_H
+
+// Energy model of the device for the host build: a storage capacitor charged
+// by a harvester according to a power profile, and drained by the tasks
+// (see capacitor.c). The runtime (runtime.c) asks the model whether each task
+// completes before the capacitor runs out.
+
+#include <stdbool.h>
+
+struct model_params {
+    const char *profile;        // file with '<seconds> <watts>' segments
+    double power;               // constant harvested power (W), if no profile
+    double duration;            // of the constant power (s)
+    double capacitance;         // F
+    double v_max, v_on, v_off;  // V: clamp, power-on, brown-out
+    double clock;               // Hz
+    double cycle_energy;        // J per active cycle
+    double sleep_power;         // W in the low-power wait
+    double sleep_time;          // s per low-power wait
+};
+
+// Work done by a task, from which the model estimates its cycles
+struct task_cost {
+    unsigned long reads;          // channel reads
+    unsigned long bytes_written;  // to channels (FRAM), with timestamps
+    unsigned long bytes_printed;  // to the console (UART)
+};
+
+void model_defaults(struct model_params *params);
+int model_init(const struct model_params *params);
+
+// Whether the device is powered by the model (false: continuous power)
+bool model_enabled();
+
+// Charge up until the device powers on and boot, false if the profile ended
+bool model_power_on();
+
+// Account for a task, false if power failed before it completed
+bool model_run_task(const struct task_cost *cost);
+
+// Account for the energy drawn by a task that power failed in, and forget
+// its work so far
+void model_task_failed();
+
+// Whether the harvest profile has ended
+bool model_finished();
+
+// Print the energy totals, with 'samples' logged by the app
+void model_report(unsigned long samples);
+
+// Called by the model when power fails in the middle of a task
+void chain_power_fail() __attribute__ ((noreturn));
+
+// Called by the model for the work done by the current task so far
+const struct task_cost *chain_task_cost();
+
+#endif // HOST_MODEL_H
@@ -0,0 +1,316 @@
+// Runtime of the host build: runs the tasks of the app, with channels that
+// can undo the writes of a task when the energy model (capacitor.c) says
+// that power failed before the task completed, and a console that only
+// outputs what completed tasks printed.
+
+#include <getopt.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <msp430.h>
+#include <libchain/chain.h>
+#include <libio/log.h>
+
+#include "model.h"
+
+#define MAX_TASKS 32
+
+// Registers of the MCU that the app touches
+volatile uint16_t P1DIR, P1OUT, P4DIR, P4OUT, PJDIR, PJOUT;
+volatile uint16_t ADC12CTL0, ADC12CTL1, ADC12CTL3;
+volatile uint16_t ADC12MCTL0, ADC12MEM0;
+
+extern task_func_t *chain_entry_task;
+extern void (*chain_init_func)();
+
+struct task_stats {
+    unsigned long completed;
+    unsigned long failed;
+};
+
+static task_t tasks[MAX_TASKS];
+static struct task_stats task_stats[MAX_TASKS];
+static unsigned num_tasks;
+
+static context_t context;
+context_t * volatile curctx = &context;
+
+static task_func_t *next_task;
+static chain_time_t chain_time; // of the latest channel write
+static struct task_cost cost;   // of the current task
+static unsigned dirty_self_fields; // written by the current task
+static jmp_buf power_fail;
+
+// Previous contents of the channel fields written by the current task
+struct undo {
+    void *dest;
+    chain_time_t *timestamp;
+    chain_time_t prev_timestamp;
+    size_t size;
+    size_t offset;              // of the previous value in undo_data
+};
+
+static struct undo *undo_log;
+static size_t undo_len, undo_cap;
+static uint8_t *undo_data;
+static size_t undo_data_len, undo_data_cap;
+
+static char *console;           // output of the current task
+static size_t console_len, console_cap;
+
+static void *grow(void *buf, size_t *cap, size_t need, size_t elem_size)
+{
+    if (need > *cap) {
+        *cap = need * 2;
+        buf = realloc(buf, *cap * elem_size);
+        if (!buf) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+    return buf;
+}
+
+void chain_register_task(unsigned idx, const char *name, task_func_t *func)
+{
+    if (num_tasks == MAX_TASKS) {
+        fprintf(stderr, "too many tasks\n");
+        exit(1);
+    }
+    tasks[num_tasks].idx = idx;
+    tasks[num_tasks].name = name;
+    tasks[num_tasks].func = func;
+    num_tasks++;
+}
+
+static unsigned task_id(task_func_t *func)
+{
+    unsigned i;
+
+    for (i = 0; i < num_tasks; ++i)
+        if (tasks[i].func == func)
+            return i;
+    fprintf(stderr, "transition to an unknown task\n");
+    exit(1);
+}
+
+void chain_transition(task_func_t *next)
+{
+    next_task = next;
+}
+
+void chain_write(void *dest, const void *val, size_t size, chain_time_t *ts)
+{
+    struct undo *undo;
+
+    undo_log = grow(undo_log, &undo_cap, undo_len + 1, sizeof(*undo_log));
+    undo_data = grow(undo_data, &undo_data_cap, undo_data_len + size, 1);
+
+    undo = &undo_log[undo_len++];
+    undo->dest = dest;
+    undo->timestamp = ts;
+    undo->prev_timestamp = *ts;
+    undo->size = size;
+    undo->offset = undo_data_len;
+    memcpy(undo_data + undo_data_len, dest, size);
+    undo_data_len += size;
+
+    memcpy(dest, val, size);
+    *ts = ++chain_time;
+
+    cost.bytes_written += size + sizeof(*ts);
+}
+
+void chain_self_write(void)
+{
+    if (++dirty_self_fields > MAX_DIRTY_SELF_FIELDS) {
+        fprintf(stderr, "%s: writes more than %u self channel fields\n",
+                curctx->task->name, MAX_DIRTY_SELF_FIELDS);
+        exit(1);
+    }
+}
+
+void *chain_read(size_t count, ...)
+{
+    void *latest = NULL;
+    chain_time_t latest_ts = 0;
+    va_list args;
+
+    va_start(args, count);
+    while (count--) {
+        void *value = va_arg(args, void *);
+        chain_time_t *ts = va_arg(args, chain_time_t *);
+        if (!latest || *ts > latest_ts) {
+            latest = value;
+            latest_ts = *ts;
+        }
+    }
+    va_end(args);
+
+    cost.reads++;
+    return latest;
+}
+
+int chain_printf(const char *fmt, ...)
+{
+    va_list args;
+    int len;
+
+    va_start(args, fmt);
+    len = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+    if (len < 0)
+        return len;
+
+    console = grow(console, &console_cap, console_len + len + 1, 1);
+    va_start(args, fmt);
+    vsnprintf(console + console_len, len + 1, fmt, args);
+    va_end(args);
+    console_len += len;
+
+    cost.bytes_printed += len;
+    return len;
+}
+
+const struct task_cost *chain_task_cost()
+{
+    return &cost;
+}
+
+void chain_power_fail()
+{
+    longjmp(power_fail, 1);
+}
+
+static void task_rollback(chain_time_t start_time)
+{
+    model_task_failed();
+    while (undo_len--) {
+        struct undo *undo = &undo_log[undo_len];
+        memcpy(undo->dest, undo_data + undo->offset, undo->size);
+        *undo->timestamp = undo->prev_timestamp;
+    }
+    undo_len = undo_data_len = 0;
+    chain_time = start_time;
+    console_len = 0;
+}
+
+static void task_commit()
+{
+    fwrite(console, 1, console_len, stdout);
+    undo_len = undo_data_len = 0;
+    console_len = 0;
+}
+
+static void usage(const char *prog, const struct model_params *p)
+{
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "\n"
+        "Runs the app on harvested energy given a profile (-p or -P), or\n"
+        "else on continuous power. Blocks go to stdout, the report to stderr.\n"
+        "\n"
+        "  -p file     harvest profile: lines of '<seconds> <watts>'\n"
+        "  -P watts    constant harvested power\n"
+        "  -T seconds  duration of -P, or of continuous power (default %g)\n"
+        "  -C farads   storage capacitor (default %g)\n"
+        "  -V volts    capacitor max voltage (default %g)\n"
+        "  -n volts    power-on voltage (default %g)\n"
+        "  -f volts    brown-out voltage (default %g)\n"
+        "  -e joules   energy per active cycle (default %g)\n"
+        "  -s task     task that logs a sample (default task_measure_temp)\n",
+        prog, p->duration, p->capacitance, p->v_max, p->v_on, p->v_off,
+        p->cycle_energy);
+}
+
+int main(int argc, char **argv)
+{
+    struct model_params params;
+    const char *sample_task = "task_measure_temp";
+    unsigned long samples = 0;
+    task_func_t *task;
+    bool powered = false;
+    unsigned i;
+    int opt;
+
+    model_defaults(&params);
+    while ((opt = getopt(argc, argv, "p:P:T:C:V:n:f:e:s:h")) != -1) {
+        switch (opt) {
+            case 'p': params.profile = optarg; break;
+            case 'P': params.power = atof(optarg); break;
+            case 'T': params.duration = atof(optarg); break;
+            case 'C': params.capacitance = atof(optarg); break;
+            case 'V': params.v_max = atof(optarg); break;
+            case 'n': params.v_on = atof(optarg); break;
+            case 'f': params.v_off = atof(optarg); break;
+            case 'e': params.cycle_energy = atof(optarg); break;
+            case 's': sample_task = optarg; break;
+            default:
+                usage(argv[0], &params);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (model_init(&params))
+        return 1;
+
+    task = chain_entry_task;
+    while (!model_finished()) {
+        chain_time_t start_time = chain_time;
+        unsigned id = task_id(task);
+        bool completed;
+
+        if (!powered) {
+            if (!model_power_on())
+                break;
+            chain_init_func(); // on every boot
+            powered = true;
+        }
+
+        context.task = &tasks[id];
+        next_task = NULL;
+        memset(&cost, 0, sizeof(cost));
+        dirty_self_fields = 0;
+
+        if (setjmp(power_fail) == 0) {
+            task();
+            completed = model_run_task(&cost);
+        } else {
+            completed = false;
+        }
+
+        if (!completed) { // re-execute after the next boot
+            task_rollback(start_time);
+            task_stats[id].failed++;
+            powered = false;
+            continue;
+        }
+
+        task_commit();
+        task_stats[id].completed++;
+        if (!strcmp(tasks[id].name, sample_task))
+            samples++;
+
+        if (!next_task) {
+            fprintf(stderr, "%s: no transition\n", tasks[id].name);
+            return 1;
+        }
+        // A task that loops to itself without touching channels is the end
+        if (next_task == task && !cost.reads && !cost.bytes_written)
+            break;
+        task = next_task;
+    }
+    fflush(stdout);
+
+    fprintf(stderr, "%-24s %10s %10s\n", "task", "completed", "failed");
+    for (i = 0; i < num_tasks; ++i)
+        if (task_stats[i].completed || task_stats[i].failed)
+            fprintf(stderr, "%-24s %10lu %10lu\n", tasks[i].name,
+                    task_stats[i].completed, task_stats[i].failed);
+    model_report(samples);
+    return 0;
+}
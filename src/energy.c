@@ -0,0 +1,59 @@
+#include <msp430.h>
+#include <stdint.h>
+
+#include "energy.h"
+
+#define REF_MV 2000 // internal reference used for the measurement
+
+uint16_t energy_level()
+{
+    // The MCU runs off the storage capacitor, so measure AVCC (the ADC has a
+    // channel for AVCC/2) against the internal reference.
+    while (REFCTL0 & REFGENBUSY);
+    REFCTL0 = REFVSEL_1 | REFON; // 2.0 V
+
+    ADC12CTL0 &= ~ADC12ENC; // disable conversion so we can set control bits
+    ADC12CTL0 = ADC12SHT0_2 + ADC12ON; // sampling time, ADC12 on
+    ADC12CTL1 = ADC12SHP + ADC12CONSEQ_0; // use sampling timer, single-channel, single-conversion
+    ADC12CTL2 = ADC12RES_2; // 12-bit
+    ADC12CTL3 |= ADC12BATMAP; // enable the AVCC/2 divider
+    ADC12MCTL0 = ADC12INCH_31 | ADC12VRSEL_1; // AVCC/2, VR+ = VREF
+
+    while (!(REFCTL0 & REFGENRDY));
+
+    ADC12CTL0 |= ADC12ENC; // enable ADC
+
+    // Trigger
+    ADC12CTL0 &= ~ADC12SC;  // 'start conversion' bit must be toggled
+    ADC12CTL0 |= ADC12SC; // start conversion
+
+    while (ADC12CTL1 & ADC12BUSY); // wait for conversion to complete
+
+    ADC12CTL3 &= ~ADC12BATMAP; // disable the divider (it draws current)
+
+    uint16_t sample = ADC12MEM0;
+
+    ADC12CTL0 &= ~(ADC12ENC | ADC12ON);
+    REFCTL0 &= ~REFON;
+
+    return ((uint32_t)sample * 2 * REF_MV) >> 12; // 12-bit, of AVCC/2
+}
+
+void energy_sleep()
+{
+    // Watchdog in interval mode off VLO (~10 kHz): wakes up after ~50 ms
+    WDTCTL = WDTPW | WDTTMSEL | WDTCNTCL | WDTSSEL__VLO | WDTIS__512;
+    SFRIFG1 &= ~WDTIFG;
+    SFRIE1 |= WDTIE;
+
+    __bis_SR_register(LPM3_bits | GIE);
+
+    SFRIE1 &= ~WDTIE;
+    WDTCTL = WDTPW | WDTHOLD;
+}
+
+__attribute__ ((interrupt(WDT_VECTOR)))
+void WDT_ISR(void)
+{
+    __bic_SR_register_on_exit(LPM3_bits);
+}
@@ -0,0 +1,12 @@
+#ifndef ENERGY_H
+#define ENERGY_H
+
+#include <stdint.h>
+
+// Voltage of the storage capacitor, in millivolts
+uint16_t energy_level();
+
+// Wait in a low-power mode for a while, to let the capacitor charge up
+void energy_sleep();
+
+#endif
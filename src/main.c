@@ -13,12 +13,31 @@
 
 #include "pins.h"
 
+#ifdef CONFIG_ENERGY_AWARE
+#include "energy.h"
+#endif
+
 #define TEST_SAMPLE_DATA
 
 #define NIL 0 // like NULL, but for indexes, not real pointers
 
+#ifndef DICT_SIZE
 #define DICT_SIZE         512
+#endif
+#ifndef BLOCK_SIZE
 #define BLOCK_SIZE         64
+#endif
+
+#ifndef NUM_BLOCKS
+#define NUM_BLOCKS          1 // stop after this many blocks (0: never)
+#endif
+
+// A block lost on the way to the gateway makes the rest of its dictionary
+// epoch undecodable. Resets bound the loss: the dictionary is reset at least
+// every this many blocks (0: only when it is full).
+#ifndef RESYNC_BLOCKS
+#define RESYNC_BLOCKS       0
+#endif
 
 #if 0 // These are largest Mementos with volatile vars can handle
 #define DICT_SIZE         280
@@ -30,15 +49,124 @@
 #define LETTER_SIZE_BITS             8
 #define NUM_LETTERS (LETTER_MASK + 1)
 
+// Every symbol adds one node, and the dictionary is reset between blocks when
+// the next block would not fit (see task_print).
+#if DICT_SIZE - NUM_LETTERS < BLOCK_SIZE
+#error Dictionary must have room for at least one block worth of nodes
+#endif
+
+// Lossy quantization of samples, before they are letterized: the logged value
+// is the sample in units of QUANT_STEP ADC counts, and it is held at the
+// previous value while the sample stays within QUANT_MAX_ERROR of it. The
+// decoder reconstructs (logged value * QUANT_STEP), which is guaranteed to be
+// within QUANT_MAX_ERROR counts of the measured sample.
+#ifndef QUANT_STEP
+#define QUANT_STEP          1 // 1: lossless
+#endif
+#ifndef QUANT_DEADBAND
+#define QUANT_DEADBAND      0 // extra tolerance (in ADC counts) before a change
+#endif
+
+#if QUANT_STEP < 1
+#error Quantization step must be at least 1 (1: lossless)
+#endif
+#define QUANT_MAX_ERROR (QUANT_STEP / 2 + QUANT_DEADBAND)
+#define QUANTIZE (QUANT_STEP > 1 || QUANT_DEADBAND > 0)
+#define QUANT_NONE ((sample_t)~0) // no previous value
+
+// Each block header carries a summary of the samples measured during the block
+// (before quantization), so that the logs can be queried without decoding
+// them (see tools/query.c). Crossings are samples that reached the threshold
+// from below it.
+#ifndef SUMMARY_THRESHOLD
+#define SUMMARY_THRESHOLD 0x0800 // ADC counts
+#endif
+
+#ifdef CONFIG_ENERGY_AWARE
+// Below these levels of stored energy, the expensive tasks are deferred until
+// the capacitor charges up, and meanwhile samples are acquired into a backlog
+// (see task_defer). The levels leave enough energy above brown-out for the
+// task to complete: a step of a sibling walk is short, a block flush over the
+// UART is not. The energy is only measured where a brown-out wastes the most
+// work, since the measurement costs more than re-executing a short task:
+// before the flush, and every ENERGY_CHECK_WALK steps of a long walk in
+// task_add_node.
+#ifndef ENERGY_THRESHOLD_ADD
+#define ENERGY_THRESHOLD_ADD   1900 // mV, for task_add_node
+#endif
+#ifndef ENERGY_THRESHOLD_FLUSH
+#define ENERGY_THRESHOLD_FLUSH 2300 // mV, for task_print
+#endif
+#ifndef ENERGY_CHECK_WALK
+#define ENERGY_CHECK_WALK      16 // siblings
+#endif
+#ifndef BACKLOG_SIZE
+#define BACKLOG_SIZE       16 // samples
+#endif
+
+// Tasks that can be deferred
+#define DEFER_ADD_NODE      0
+#define DEFER_PRINT         1
+#endif // CONFIG_ENERGY_AWARE
+
 #define DELAY() do { \
     uint32_t delay = 0x2ffff; \
     while (delay--); \
  } while (0);
 
+#ifdef CONFIG_SIM_BENCH
+#define BENCH_MAX_TASKS    16
+
+// Event counts that the simulator harness (bld/sim) reads out of memory when
+// the app reaches task_done, to normalize the cycle count it measures. The
+// cycles of each task type are measured with Timer_A0, counting MCLK cycles
+// from one task's start to the next one's (a task must take fewer than
+// 2^16 cycles). Index 0 is the time before the first task. Each of these
+// intervals includes one run of the accounting itself, which init() times
+// (overhead) for the harness to subtract.
+volatile struct {
+    uint32_t samples;
+    uint32_t tasks;
+    uint32_t task_count[BENCH_MAX_TASKS];
+    uint32_t task_cycles[BENCH_MAX_TASKS];
+    uint16_t blocks;
+    uint16_t last_task;
+    uint16_t last_time;
+    uint16_t overhead;
+} bench;
+
+#define BENCH_COUNT(counter) (++bench.counter)
+#define BENCH_TASK() do { \
+    uint16_t now = TA0R; \
+    bench.task_cycles[bench.last_task] += (uint16_t)(now - bench.last_time); \
+    bench.last_time = now; \
+    bench.last_task = curctx->task->idx; \
+    ++bench.task_count[curctx->task->idx]; \
+    ++bench.tasks; \
+} while (0)
+
+// Time two runs of the accounting back to back
+#define BENCH_CALIBRATE() do { \
+    unsigned idx = curctx->task->idx; \
+    uint32_t cycles; \
+    BENCH_TASK(); \
+    cycles = bench.task_cycles[idx]; \
+    BENCH_TASK(); \
+    bench.overhead = bench.task_cycles[idx] - cycles; \
+    bench.task_cycles[idx] = cycles; \
+    bench.task_count[idx] -= 2; \
+    bench.tasks -= 2; \
+    bench.last_task = 0; \
+} while (0)
+#else // !CONFIG_SIM_BENCH
+#define BENCH_COUNT(counter)
+#define BENCH_TASK()
+#endif // !CONFIG_SIM_BENCH
+
 #ifdef CONT_POWER
-#define TASK_PROLOGUE() DELAY()
+#define TASK_PROLOGUE() BENCH_TASK(); DELAY()
 #else // !CONT_POWER
-#define TASK_PROLOGUE()
+#define TASK_PROLOGUE() BENCH_TASK()
 #endif // !CONT_POWER
 
 
@@ -53,6 +181,26 @@ typedef struct _node_t {
     index_t child;   // link-list of children
 } node_t;
 
+typedef struct _summary_t {
+    unsigned count;    // samples
+    sample_t min;
+    sample_t max;
+    uint32_t sum;
+    sample_t first;
+    sample_t last;     // carried over to the next block, to detect crossings
+    unsigned crossings;
+} summary_t;
+
+// Counters of task_print, kept in one field so that it writes few fields to
+// its self channel (libchain's MAX_DIRTY_SELF_FIELDS)
+typedef struct _block_state_t {
+    unsigned block_idx;
+    unsigned epoch_block_idx; // blocks since the last reset
+    unsigned letters;         // compressed before the block
+    unsigned resets;
+    index_t last_node_count;
+} block_state_t;
+
 struct msg_dict {
     CHAN_FIELD_ARRAY(node_t, dict, DICT_SIZE);
 };
@@ -83,10 +231,27 @@ struct msg_sibling {
     CHAN_FIELD(index_t, sibling);
 };
 
-struct msg_self_sibling {
+struct msg_self_add_node {
     SELF_CHAN_FIELD(index_t, sibling);
+#ifdef CONFIG_ENERGY_AWARE
+    SELF_CHAN_FIELD(unsigned, walk);
+#endif
 };
-#define FIELD_INIT_msg_self_sibling {\
+#define FIELD_INIT_msg_self_add_node {\
+    SELF_FIELD_INITIALIZER \
+    SELF_FIELD_INIT_ENERGY \
+}
+
+struct msg_hops {
+    CHAN_FIELD(unsigned, hops);
+};
+
+struct msg_self_find_sibling {
+    SELF_CHAN_FIELD(index_t, sibling);
+    SELF_CHAN_FIELD(unsigned, hops);
+};
+#define FIELD_INIT_msg_self_find_sibling {\
+    SELF_FIELD_INITIALIZER, \
     SELF_FIELD_INITIALIZER \
 }
 
@@ -171,18 +336,114 @@ struct msg_sample {
     CHAN_FIELD(sample_t, sample);
 };
 
+struct msg_summary {
+    CHAN_FIELD(summary_t, summary);
+};
+
+// Initializers for the optional fields of self channels
+#ifdef TEST_SAMPLE_DATA
+#define SELF_FIELD_INIT_TEST_DATA , SELF_FIELD_INITIALIZER
+#else
+#define SELF_FIELD_INIT_TEST_DATA
+#endif
+#if QUANTIZE
+#define SELF_FIELD_INIT_QUANT , SELF_FIELD_INITIALIZER
+#else
+#define SELF_FIELD_INIT_QUANT
+#endif
+#ifdef CONFIG_ENERGY_AWARE
+#define SELF_FIELD_INIT_ENERGY , SELF_FIELD_INITIALIZER
+#else
+#define SELF_FIELD_INIT_ENERGY
+#endif
+
+struct msg_measure_state {
+    CHAN_FIELD(summary_t, summary);
+#ifdef TEST_SAMPLE_DATA
+    CHAN_FIELD(unsigned, sample_idx);
+#endif
+#if QUANTIZE
+    CHAN_FIELD(sample_t, quant);
+#endif
+#ifdef CONFIG_ENERGY_AWARE
+    CHAN_FIELD(unsigned, backlog_head);
+    CHAN_FIELD(unsigned, backlog_tail);
+#endif
+};
+
+struct msg_self_measure_state {
+    SELF_CHAN_FIELD(summary_t, summary);
+#ifdef TEST_SAMPLE_DATA
+    SELF_CHAN_FIELD(unsigned, sample_idx);
+#endif
+#if QUANTIZE
+    SELF_CHAN_FIELD(sample_t, quant);
+#endif
+#ifdef CONFIG_ENERGY_AWARE
+    SELF_CHAN_FIELD(unsigned, backlog_tail);
+#endif
+};
+#define FIELD_INIT_msg_self_measure_state {\
+    SELF_FIELD_INITIALIZER \
+    SELF_FIELD_INIT_TEST_DATA \
+    SELF_FIELD_INIT_QUANT \
+    SELF_FIELD_INIT_ENERGY \
+}
+
+#ifdef CONFIG_ENERGY_AWARE
+struct msg_deferred {
+    CHAN_FIELD(unsigned, deferred);
+};
+
+// Steps of the sibling walk in task_add_node
+struct msg_walk {
+    CHAN_FIELD(unsigned, walk);
+};
+
+// Positions in the backlog (free-running, empty when equal), and the
+// position in the test data, which both acquiring tasks advance
+struct msg_backlog_state {
+    CHAN_FIELD(unsigned, backlog_head);
+    CHAN_FIELD(unsigned, backlog_tail);
 #ifdef TEST_SAMPLE_DATA
-struct msg_prev_sample {
-    CHAN_FIELD(sample_t, prev_sample);
+    CHAN_FIELD(unsigned, sample_idx);
+#endif
 };
 
-struct msg_self_prev_sample {
-    SELF_CHAN_FIELD(sample_t, prev_sample);
+struct msg_self_backlog_state {
+    SELF_CHAN_FIELD(unsigned, backlog_head);
+#ifdef TEST_SAMPLE_DATA
+    SELF_CHAN_FIELD(unsigned, sample_idx);
+#endif
 };
-#define FIELD_INIT_msg_self_prev_sample {\
+#define FIELD_INIT_msg_self_backlog_state {\
     SELF_FIELD_INITIALIZER \
+    SELF_FIELD_INIT_TEST_DATA \
 }
+
+struct msg_backlog {
+    CHAN_FIELD_ARRAY(sample_t, backlog, BACKLOG_SIZE);
+    CHAN_FIELD(unsigned, backlog_head);
+#ifdef TEST_SAMPLE_DATA
+    CHAN_FIELD(unsigned, sample_idx);
 #endif
+};
+#endif // CONFIG_ENERGY_AWARE
+
+// Block counters and the running stats that are reported per block
+struct msg_block_state {
+    CHAN_FIELD(unsigned, hops);
+    CHAN_FIELD(block_state_t, block);
+};
+
+struct msg_self_block_state {
+    SELF_CHAN_FIELD(unsigned, hops);
+    SELF_CHAN_FIELD(block_state_t, block);
+};
+#define FIELD_INIT_msg_self_block_state {\
+    SELF_FIELD_INITIALIZER, \
+    SELF_FIELD_INITIALIZER \
+}
 
 TASK(1, task_init)
 TASK(2, task_init_dict)
@@ -196,12 +457,13 @@ TASK(9, task_add_insert)
 TASK(10, task_append_compressed)
 TASK(11, task_print)
 TASK(12, task_done)
+#ifdef CONFIG_ENERGY_AWARE
+TASK(13, task_defer)
+#endif
 
 CHANNEL(task_init, task_init_dict, msg_letter);
 CHANNEL(task_init, task_sample, msg_letter_idx);
-#ifdef TEST_SAMPLE_DATA
-CHANNEL(task_init, task_measure_temp, msg_prev_sample);
-#endif
+CHANNEL(task_init, task_measure_temp, msg_measure_state);
 CHANNEL(task_init, task_letterize, msg_letter);
 CHANNEL(task_init, task_compress, msg_compress);
 SELF_CHANNEL(task_init_dict, msg_self_letter);
@@ -212,9 +474,7 @@ CHANNEL(task_init_dict, task_add_insert, msg_node_count);
 MULTICAST_CHANNEL(msg_dict, ch_dict, task_add_insert,
                   task_compress, task_find_sibling, task_add_node);
 SELF_CHANNEL(task_sample, msg_self_letter_idx);
-#ifdef TEST_SAMPLE_DATA
-SELF_CHANNEL(task_measure_temp, msg_self_prev_sample);
-#endif
+SELF_CHANNEL(task_measure_temp, msg_self_measure_state);
 CHANNEL(task_measure_temp, task_letterize, msg_sample);
 CHANNEL(task_sample, task_letterize, msg_letter_idx);
 MULTICAST_CHANNEL(msg_letter, ch_letter, task_letterize,
@@ -229,18 +489,41 @@ MULTICAST_CHANNEL(msg_sibling, ch_sibling, task_compress,
                   task_find_sibling, task_add_node);
 SELF_CHANNEL(task_compress, msg_self_sample_count);
 CHANNEL(task_find_sibling, task_compress, msg_parent);
-SELF_CHANNEL(task_find_sibling, msg_self_sibling);
-SELF_CHANNEL(task_add_node, msg_self_sibling);
+SELF_CHANNEL(task_find_sibling, msg_self_find_sibling);
+SELF_CHANNEL(task_add_node, msg_self_add_node);
 CHANNEL(task_add_node, task_add_insert, msg_last_sibling);
 SELF_CHANNEL(task_add_insert, msg_self_node_count);
 CHANNEL(task_add_insert, task_append_compressed, msg_symbol);
 SELF_CHANNEL(task_append_compressed, msg_self_out_len);
 CHANNEL(task_append_compressed, task_print, msg_compressed_data);
 CHANNEL(task_append_compressed, task_compress, msg_sample_count);
+CHANNEL(task_init, task_print, msg_block_state);
+SELF_CHANNEL(task_print, msg_self_block_state);
+CHANNEL(task_init, task_find_sibling, msg_hops);
+CHANNEL(task_find_sibling, task_print, msg_hops);
+CHANNEL(task_add_insert, task_print, msg_node_count);
+CHANNEL(task_print, task_find_sibling, msg_hops);
+CHANNEL(task_print, task_init_dict, msg_letter);
+CHANNEL(task_measure_temp, task_print, msg_summary);
+CHANNEL(task_print, task_measure_temp, msg_summary);
+#ifdef CONFIG_ENERGY_AWARE
+CHANNEL(task_init, task_defer, msg_backlog_state);
+CHANNEL(task_find_sibling, task_add_node, msg_walk);
+CHANNEL(task_add_node, task_defer, msg_deferred);
+CHANNEL(task_append_compressed, task_defer, msg_deferred);
+SELF_CHANNEL(task_defer, msg_self_backlog_state);
+CHANNEL(task_defer, task_measure_temp, msg_backlog);
+CHANNEL(task_measure_temp, task_defer, msg_backlog_state);
+#endif
 
 void init()
 {
+#ifndef CONFIG_SIM_BENCH // the simulator has no board peripherals
     WISP_init();
+#else
+    TA0CTL = TASSEL__SMCLK | MC__CONTINUOUS | TACLR; // cycle counter
+    BENCH_CALIBRATE();
+#endif
 
     GPIO(PORT_LED_1, DIR) |= BIT(PIN_LED_1);
     GPIO(PORT_LED_2, DIR) |= BIT(PIN_LED_2);
@@ -266,11 +549,21 @@ void init()
     EIF_PRINTF(".%u.\r\n", curctx->task->idx);
 }
 
-static sample_t acquire_sample(letter_t prev_sample)
+#ifdef CONFIG_SAMPLE_CORPUS
+#ifndef TEST_SAMPLE_DATA
+#error Sample corpus requires TEST_SAMPLE_DATA (to keep the position in it)
+#endif
+// Generated from the corpus file by the build (see bld/sim/Makefile)
+#include "corpus.h"
+#endif
+
+static sample_t acquire_sample(unsigned sample_idx)
 {
-#ifdef TEST_SAMPLE_DATA
+#if defined(CONFIG_SAMPLE_CORPUS)
+    return corpus[sample_idx % CORPUS_LEN];
+#elif defined(TEST_SAMPLE_DATA)
     //letter_t sample = rand() & 0x0F;
-    letter_t sample = (prev_sample + 1) & 0x03;
+    letter_t sample = (sample_idx + 1) & 0x03;
     return sample;
 #else
     ADC12CTL0 &= ~ADC12ENC; // disable conversion so we can set control bits
@@ -297,6 +590,52 @@ static sample_t acquire_sample(letter_t prev_sample)
 #endif
 }
 
+#if QUANTIZE
+// Quantize the sample given the previous quantized value (or QUANT_NONE)
+static sample_t quantize(sample_t sample, sample_t prev_quant)
+{
+    if (prev_quant != QUANT_NONE) {
+        sample_t prev_value = prev_quant * QUANT_STEP;
+        sample_t error = sample > prev_value ? sample - prev_value :
+                                               prev_value - sample;
+        if (error <= QUANT_MAX_ERROR) // within deadband: no change
+            return prev_quant;
+    }
+    return (sample + QUANT_STEP / 2) / QUANT_STEP; // round to nearest step
+}
+#endif
+
+static void summarize(summary_t *summary, sample_t sample)
+{
+    if (summary->count == 0) { // first sample of the block
+        summary->min = summary->max = sample;
+        summary->sum = 0;
+        summary->first = sample;
+        summary->crossings = 0;
+    } else {
+        if (sample < summary->min)
+            summary->min = sample;
+        if (sample > summary->max)
+            summary->max = sample;
+    }
+    if (summary->last < SUMMARY_THRESHOLD && sample >= SUMMARY_THRESHOLD)
+        summary->crossings++;
+
+    summary->count++;
+    summary->sum += sample;
+    summary->last = sample;
+}
+
+#ifdef CONFIG_ENERGY_AWARE
+static bool energy_low(unsigned deferred)
+{
+    unsigned level = energy_level();
+    LOG("energy: %u mV\r\n", level);
+    return level < (deferred == DEFER_PRINT ? ENERGY_THRESHOLD_FLUSH :
+                                              ENERGY_THRESHOLD_ADD);
+}
+#endif
+
 void task_init()
 {
     TASK_PROLOGUE();
@@ -316,11 +655,46 @@ void task_init()
     letter_t letter = 0;
     CHAN_OUT1(letter_t, letter, letter, CH(task_init, task_init_dict));
 
+    summary_t summary = {
+        .count = 0,
+        .last = SUMMARY_THRESHOLD, // the first sample is not a crossing
+    };
+    CHAN_OUT1(summary_t, summary, summary, CH(task_init, task_measure_temp));
+
 #ifdef TEST_SAMPLE_DATA
-    letter_t prev_sample = 0;
-    CHAN_OUT1(letter_t, prev_sample, prev_sample, CH(task_init, task_measure_temp));
+    unsigned sample_idx = 0;
+    CHAN_OUT1(unsigned, sample_idx, sample_idx, CH(task_init, task_measure_temp));
+#endif
+
+#if QUANTIZE
+    sample_t quant = QUANT_NONE;
+    CHAN_OUT1(sample_t, quant, quant, CH(task_init, task_measure_temp));
 #endif
 
+#ifdef CONFIG_ENERGY_AWARE
+    unsigned backlog_pos = 0; // empty
+    CHAN_OUT1(unsigned, backlog_head, backlog_pos, CH(task_init, task_measure_temp));
+    CHAN_OUT1(unsigned, backlog_tail, backlog_pos, CH(task_init, task_measure_temp));
+    CHAN_OUT1(unsigned, backlog_head, backlog_pos, CH(task_init, task_defer));
+    CHAN_OUT1(unsigned, backlog_tail, backlog_pos, CH(task_init, task_defer));
+#ifdef TEST_SAMPLE_DATA
+    CHAN_OUT1(unsigned, sample_idx, sample_idx, CH(task_init, task_defer));
+#endif
+#endif
+
+    block_state_t block = {
+        .block_idx = 0,
+        .epoch_block_idx = 0,
+        .letters = 0,
+        .resets = 0,
+        .last_node_count = NUM_LETTERS,
+    };
+    CHAN_OUT1(block_state_t, block, block, CH(task_init, task_print));
+
+    unsigned hops = 0;
+    CHAN_OUT1(unsigned, hops, hops, CH(task_init, task_print));
+    CHAN_OUT1(unsigned, hops, hops, CH(task_init, task_find_sibling));
+
     unsigned letter_idx = 0;
     CHAN_OUT1(unsigned, letter_idx, letter_idx, CH(task_init, task_sample));
 
@@ -333,9 +707,12 @@ void task_init()
 
 void task_init_dict()
 {
-    letter_t letter = *CHAN_IN2(letter_t, letter,
+    BENCH_TASK();
+
+    letter_t letter = *CHAN_IN3(letter_t, letter,
                                 CH(task_init, task_init_dict),
-                                SELF_IN_CH(task_init_dict));
+                                SELF_IN_CH(task_init_dict),
+                                CH(task_print, task_init_dict));
 
     LOG("init dict: letter %u\r\n", letter);
 
@@ -364,6 +741,8 @@ void task_init_dict()
 
 void task_sample()
 {
+    BENCH_TASK();
+
     unsigned letter_idx = *CHAN_IN2(unsigned, letter_idx,
                                     CH(task_init, task_sample),
                                     SELF_IN_CH(task_sample));
@@ -390,22 +769,77 @@ void task_measure_temp()
 {
     TASK_PROLOGUE();
 
-    sample_t prev_sample;
-
-#ifdef TEST_SAMPLE_DATA
-    prev_sample = *CHAN_IN2(letter_t, prev_sample,
-                                     CH(task_init, task_measure_temp),
-                                     SELF_IN_CH(task_measure_temp));
+    unsigned sample_idx;
+    sample_t sample;
+    bool from_backlog = false;
+
+#if defined(TEST_SAMPLE_DATA) && defined(CONFIG_ENERGY_AWARE)
+    sample_idx = *CHAN_IN3(unsigned, sample_idx,
+                           CH(task_init, task_measure_temp),
+                           SELF_IN_CH(task_measure_temp),
+                           CH(task_defer, task_measure_temp));
+#elif defined(TEST_SAMPLE_DATA)
+    sample_idx = *CHAN_IN2(unsigned, sample_idx,
+                           CH(task_init, task_measure_temp),
+                           SELF_IN_CH(task_measure_temp));
 #else
-    prev_sample = 0;
+    sample_idx = 0;
 #endif
 
-    sample_t sample = acquire_sample(prev_sample);
-    LOG("measure: %u\r\n", sample);
+#ifdef CONFIG_ENERGY_AWARE
+    // Samples acquired while the compressor was deferred go first
+    unsigned backlog_head = *CHAN_IN2(unsigned, backlog_head,
+                                      CH(task_init, task_measure_temp),
+                                      CH(task_defer, task_measure_temp));
+    unsigned backlog_tail = *CHAN_IN2(unsigned, backlog_tail,
+                                      CH(task_init, task_measure_temp),
+                                      SELF_IN_CH(task_measure_temp));
+    if (backlog_tail != backlog_head) {
+        sample = *CHAN_IN1(sample_t, backlog[backlog_tail % BACKLOG_SIZE],
+                           CH(task_defer, task_measure_temp));
+        LOG("measure: from backlog %u\r\n", sample);
+
+        backlog_tail++;
+        CHAN_OUT2(unsigned, backlog_tail, backlog_tail,
+                  SELF_OUT_CH(task_measure_temp),
+                  CH(task_measure_temp, task_defer));
+        from_backlog = true;
+    }
+#endif
 
-#ifdef TEST_SAMPLE_DATA
-    prev_sample = sample;
-    CHAN_OUT1(letter_t, prev_sample, prev_sample, SELF_OUT_CH(task_measure_temp));
+    if (!from_backlog) {
+        sample = acquire_sample(sample_idx);
+        LOG("measure: %u\r\n", sample);
+        BENCH_COUNT(samples);
+
+#if defined(TEST_SAMPLE_DATA) && defined(CONFIG_ENERGY_AWARE)
+        sample_idx++;
+        CHAN_OUT2(unsigned, sample_idx, sample_idx,
+                  SELF_OUT_CH(task_measure_temp),
+                  CH(task_measure_temp, task_defer));
+#elif defined(TEST_SAMPLE_DATA)
+        sample_idx++;
+        CHAN_OUT1(unsigned, sample_idx, sample_idx,
+                  SELF_OUT_CH(task_measure_temp));
+#endif
+    }
+
+    summary_t summary = *CHAN_IN3(summary_t, summary,
+                                  CH(task_init, task_measure_temp),
+                                  SELF_IN_CH(task_measure_temp),
+                                  CH(task_print, task_measure_temp));
+    summarize(&summary, sample);
+    CHAN_OUT2(summary_t, summary, summary,
+              SELF_OUT_CH(task_measure_temp),
+              CH(task_measure_temp, task_print));
+
+#if QUANTIZE
+    sample_t quant = *CHAN_IN2(sample_t, quant,
+                               CH(task_init, task_measure_temp),
+                               SELF_IN_CH(task_measure_temp));
+    sample = quantize(sample, quant);
+    LOG("measure: quantized %u\r\n", sample);
+    CHAN_OUT1(sample_t, quant, sample, SELF_OUT_CH(task_measure_temp));
 #endif
 
     CHAN_OUT1(sample_t, sample, sample, CH(task_measure_temp, task_letterize));
@@ -526,10 +960,20 @@ void task_find_sibling()
             LOG("find sibling: found %u\r\n", sibling);
             CHAN_OUT1(index_t, parent, sibling,
                       CH(task_find_sibling, task_compress));
-            TRANSITION_TO(task_letterize);
+            TRANSITION_TO(task_sample); // extend the phrase with the next letter
         } else { // continue traversing the siblings
             CHAN_OUT1(index_t, sibling, sibling_node->sibling,
                       SELF_OUT_CH(task_find_sibling));
+
+            unsigned hops = *CHAN_IN3(unsigned, hops,
+                                      CH(task_init, task_find_sibling),
+                                      SELF_IN_CH(task_find_sibling),
+                                      CH(task_print, task_find_sibling));
+            hops++;
+            CHAN_OUT2(unsigned, hops, hops,
+                      SELF_OUT_CH(task_find_sibling),
+                      CH(task_find_sibling, task_print));
+
             TRANSITION_TO(task_find_sibling);
         }
 
@@ -551,9 +995,15 @@ void task_find_sibling()
         index_t child = *CHAN_IN1(index_t, child,
                                   CH(task_compress, task_find_sibling));
         LOG("find sibling: child %u\r\n", child);
+
         if (child == NIL) {
             TRANSITION_TO(task_add_insert);
         } else {
+#ifdef CONFIG_ENERGY_AWARE
+            unsigned walk = 0;
+            CHAN_OUT1(unsigned, walk, walk,
+                      CH(task_find_sibling, task_add_node));
+#endif
             TRANSITION_TO(task_add_node); 
         }
     }
@@ -591,6 +1041,23 @@ void task_add_node()
 
         index_t next_sibling = sibling_node->sibling;
         CHAN_OUT1(index_t, sibling, next_sibling, SELF_OUT_CH(task_add_node));
+
+#ifdef CONFIG_ENERGY_AWARE
+        unsigned walk = *CHAN_IN2(unsigned, walk,
+                                  CH(task_find_sibling, task_add_node),
+                                  SELF_IN_CH(task_add_node));
+        walk++;
+        CHAN_OUT1(unsigned, walk, walk, SELF_OUT_CH(task_add_node));
+
+        // Resumes at the next sibling
+        if (walk % ENERGY_CHECK_WALK == 0 && energy_low(DEFER_ADD_NODE)) {
+            unsigned deferred = DEFER_ADD_NODE;
+            CHAN_OUT1(unsigned, deferred, deferred,
+                      CH(task_add_node, task_defer));
+            TRANSITION_TO(task_defer);
+        }
+#endif
+
         TRANSITION_TO(task_add_node);
 
     } else { // found last sibling in the list
@@ -618,11 +1085,10 @@ void task_add_insert()
 
     LOG("add insert: nodes %u\r\n", node_count);
 
-    if (node_count == DICT_SIZE) { // wipe the table if full
-
+    // Can't happen: task_print resets the dictionary before the block in
+    // which it would fill up.
+    if (node_count == DICT_SIZE) {
         PRINTF("add insert: dict full\r\n");
-
-        // TODO: clear table  (re-initialize root nodes)
         while (1);
     }
 
@@ -683,7 +1149,9 @@ void task_add_insert()
 
     node_count++;
 
-    CHAN_OUT1(index_t, node_count, node_count, SELF_OUT_CH(task_add_insert));
+    CHAN_OUT2(index_t, node_count, node_count,
+              SELF_OUT_CH(task_add_insert),
+              CH(task_add_insert, task_print));
 
     TRANSITION_TO(task_append_compressed);
 }
@@ -719,6 +1187,16 @@ void task_append_compressed()
 
         CHAN_OUT1(unsigned, out_len, out_len,
                   SELF_OUT_CH(task_append_compressed));
+
+#ifdef CONFIG_ENERGY_AWARE
+        unsigned deferred = DEFER_PRINT;
+        if (energy_low(deferred)) {
+            CHAN_OUT1(unsigned, deferred, deferred,
+                      CH(task_append_compressed, task_defer));
+            TRANSITION_TO(task_defer);
+        }
+#endif
+
         TRANSITION_TO(task_print);
     } else {
         CHAN_OUT1(unsigned, out_len, out_len,
@@ -727,6 +1205,12 @@ void task_append_compressed()
     }
 }
 
+// Print a fixed-point ratio with two decimal places
+#define FRAC_FMT "%u.%02u"
+#define FRAC_ARGS(num, den) \
+    (unsigned)((uint32_t)(num) / (den)), \
+    (unsigned)((uint32_t)(num) * 100 / (den) % 100)
+
 void task_print()
 {
     TASK_PROLOGUE();
@@ -736,8 +1220,42 @@ void task_print()
     unsigned sample_count = *CHAN_IN1(unsigned, sample_count,
                                       CH(task_append_compressed, task_print));
 
+    // Stats are accumulated over the block by the tasks that see the events
+    index_t node_count = *CHAN_IN1(index_t, node_count,
+                                   CH(task_add_insert, task_print));
+    unsigned hops = *CHAN_IN3(unsigned, hops,
+                              CH(task_init, task_print),
+                              SELF_IN_CH(task_print),
+                              CH(task_find_sibling, task_print));
+
+    // Position of the block in the stream, for the decoder to detect lost
+    // blocks and to resume at the next epoch, and the stats since the reset
+    block_state_t block = *CHAN_IN2(block_state_t, block,
+                                    CH(task_init, task_print),
+                                    SELF_IN_CH(task_print));
+
+    // Every block has samples: each of its symbols consumed at least a letter
+    summary_t summary = *CHAN_IN1(summary_t, summary,
+                                  CH(task_measure_temp, task_print));
+
     BLOCK_PRINTF_BEGIN();
     BLOCK_PRINTF("compressed block:\r\n");
+    BLOCK_PRINTF("seq: block %u offset %u letters %u\r\n",
+                 block.block_idx, block.epoch_block_idx, block.letters);
+    BLOCK_PRINTF("quant: step %u deadband %u max err %u\r\n",
+                 QUANT_STEP, QUANT_DEADBAND, QUANT_MAX_ERROR);
+    BLOCK_PRINTF("stats: nodes %u/%u phrase " FRAC_FMT " hops " FRAC_FMT
+                 " new %u resets %u\r\n",
+                 node_count, DICT_SIZE,
+                 FRAC_ARGS(sample_count, BLOCK_SIZE),
+                 FRAC_ARGS(hops, sample_count),
+                 node_count - block.last_node_count, block.resets);
+    BLOCK_PRINTF("summary: samples %u min %u max %u mean " FRAC_FMT
+                 " first %u last %u threshold %u crossings %u\r\n",
+                 summary.count, summary.min, summary.max,
+                 FRAC_ARGS(summary.sum, summary.count),
+                 summary.first, summary.last,
+                 SUMMARY_THRESHOLD, summary.crossings);
     for (i = 0; i < BLOCK_SIZE; ++i) {
         index_t index = *CHAN_IN1(index_t, compressed_data[i],
                                   CH(task_append_compressed, task_print));
@@ -749,9 +1267,118 @@ void task_print()
     BLOCK_PRINTF("rate: samples/block: %u/%u\r\n", sample_count, BLOCK_SIZE);
     BLOCK_PRINTF_END();
 
-    //TRANSITION_TO(task_sample); // restart app
-    TRANSITION_TO(task_done); // for now just do one block
+    BENCH_COUNT(blocks);
+
+    hops = 0;
+    CHAN_OUT2(unsigned, hops, hops,
+              SELF_OUT_CH(task_print),
+              CH(task_print, task_find_sibling));
+
+    summary.count = 0; // start the next block's summary, but keep the last
+    CHAN_OUT1(summary_t, summary, summary, CH(task_print, task_measure_temp));
+
+    block.block_idx++;
+    block.letters += sample_count;
+
+    if (block.block_idx == NUM_BLOCKS) {
+        TRANSITION_TO(task_done);
+    } else {
+        // Reset the dictionary if the next block might not fit into it, or to
+        // resync the decoder periodically. The symbols are flushed, and the
+        // phrase in progress is at a root node, which survives the reset, so
+        // nothing is lost.
+        block.epoch_block_idx++;
+        if (node_count + BLOCK_SIZE > DICT_SIZE ||
+            (RESYNC_BLOCKS > 0 && block.epoch_block_idx == RESYNC_BLOCKS)) {
+            LOG("print: reset dict\r\n");
+
+            block.resets++;
+            block.epoch_block_idx = 0;
+            block.last_node_count = NUM_LETTERS;
+
+            letter_t letter = 0;
+            CHAN_OUT1(letter_t, letter, letter, CH(task_print, task_init_dict));
+        } else {
+            block.last_node_count = node_count;
+        }
+
+        CHAN_OUT1(block_state_t, block, block, SELF_OUT_CH(task_print));
+
+        if (block.last_node_count == NUM_LETTERS) {
+            TRANSITION_TO(task_init_dict); // continues to the next block
+        } else {
+            TRANSITION_TO(task_sample); // next block
+        }
+    }
+}
+
+#ifdef CONFIG_ENERGY_AWARE
+// Wait for the capacitor to charge up before running the deferred task,
+// acquiring a sample into the backlog on every wake-up (if there is room).
+void task_defer()
+{
+    TASK_PROLOGUE();
+
+    unsigned deferred = *CHAN_IN2(unsigned, deferred,
+                                  CH(task_add_node, task_defer),
+                                  CH(task_append_compressed, task_defer));
+    unsigned backlog_head = *CHAN_IN2(unsigned, backlog_head,
+                                      CH(task_init, task_defer),
+                                      SELF_IN_CH(task_defer));
+    unsigned backlog_tail = *CHAN_IN2(unsigned, backlog_tail,
+                                      CH(task_init, task_defer),
+                                      CH(task_measure_temp, task_defer));
+
+    LOG("defer: task %u backlog %u-%u\r\n", deferred,
+        backlog_tail, backlog_head);
+
+    if (backlog_head - backlog_tail < BACKLOG_SIZE) {
+        unsigned sample_idx;
+
+#ifdef TEST_SAMPLE_DATA
+        sample_idx = *CHAN_IN3(unsigned, sample_idx,
+                               CH(task_init, task_defer),
+                               SELF_IN_CH(task_defer),
+                               CH(task_measure_temp, task_defer));
+#else
+        sample_idx = 0;
+#endif
+
+        sample_t sample = acquire_sample(sample_idx);
+        LOG("defer: sample %u\r\n", sample);
+        BENCH_COUNT(samples);
+
+        CHAN_OUT1(sample_t, backlog[backlog_head % BACKLOG_SIZE], sample,
+                  CH(task_defer, task_measure_temp));
+        backlog_head++;
+        CHAN_OUT2(unsigned, backlog_head, backlog_head,
+                  SELF_OUT_CH(task_defer),
+                  CH(task_defer, task_measure_temp));
+
+#ifdef TEST_SAMPLE_DATA
+        sample_idx++;
+        CHAN_OUT2(unsigned, sample_idx, sample_idx,
+                  SELF_OUT_CH(task_defer),
+                  CH(task_defer, task_measure_temp));
+#endif
+    }
+
+    energy_sleep();
+
+    if (energy_low(deferred)) {
+        TRANSITION_TO(task_defer);
+    }
+
+    switch (deferred) {
+        case DEFER_ADD_NODE:
+            TRANSITION_TO(task_add_node);
+            break;
+        default: // DEFER_PRINT
+            TRANSITION_TO(task_print);
+            break;
+    }
 }
+#endif // CONFIG_ENERGY_AWARE
 
 void task_done()
 {
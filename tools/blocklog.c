@@ -0,0 +1,710 @@
+#define _GNU_SOURCE // memmem
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "blocklog.h"
+
+#define BLOCK_MARKER "compressed block:"
+#define NO_SYMBOL (~0u)
+#define COUNTER_MASK 0xffff // the device's counters wrap around at 16 bits
+
+// A node of the decoder's dictionary: the phrase is the prefix's phrase
+// followed by the letter
+struct lzw_node {
+    uint16_t prefix;
+    uint8_t letter;
+    uint8_t first;      // first letter of the phrase
+    uint32_t len;
+};
+
+int log_open(struct log *log, const char *path)
+{
+    const char *base = strrchr(path, '/');
+    struct stat st;
+    char *ext;
+    int fd = -1;
+
+    memset(log, 0, sizeof(*log));
+
+    log->name = strdup(base ? base + 1 : path);
+    log->path = strdup(path);
+    if (!log->name || !log->path)
+        goto fail;
+    ext = strrchr(log->name, '.');
+    if (ext && ext != log->name)
+        *ext = '\0';
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        goto fail;
+    }
+    log->size = st.st_size;
+    log->mtime = st.st_mtim;
+    if (log->size > 0) {
+        log->data = mmap(NULL, log->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (log->data == MAP_FAILED) {
+            fprintf(stderr, "%s: mmap: %s\n", path, strerror(errno));
+            log->data = NULL;
+            goto fail;
+        }
+        madvise((void *)log->data, log->size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+    return 0;
+
+fail:
+    if (fd >= 0)
+        close(fd);
+    free(log->name);
+    free(log->path);
+    log->name = NULL;
+    log->path = NULL;
+    return -1;
+}
+
+void log_close(struct log *log)
+{
+    if (log->data)
+        munmap((void *)log->data, log->size);
+    free(log->blocks);
+    free(log->name);
+    free(log->path);
+    memset(log, 0, sizeof(*log));
+}
+
+static const char *line_end(const char *p, const char *end)
+{
+    const char *nl = memchr(p, '\n', end - p);
+    return nl ? nl : end;
+}
+
+static int starts_with(const char *p, const char *end, const char *prefix)
+{
+    size_t len = strlen(prefix);
+    return (size_t)(end - p) >= len && !memcmp(p, prefix, len);
+}
+
+static int parse_uint(const char **pp, const char *end, unsigned *val)
+{
+    const char *p = *pp;
+    unsigned v = 0;
+
+    while (p < end && *p == ' ')
+        ++p;
+    if (p == end || *p < '0' || *p > '9')
+        return -1;
+    while (p < end && *p >= '0' && *p <= '9')
+        v = v * 10 + (*p++ - '0');
+    *val = v;
+    *pp = p;
+    return 0;
+}
+
+// Parse the number after 'key' in the line
+static int parse_field(const char *line, const char *end, const char *key,
+                       unsigned *val)
+{
+    const char *p = memmem(line, end - line, key, strlen(key));
+
+    if (!p)
+        return -1;
+    p += strlen(key);
+    return parse_uint(&p, end, val);
+}
+
+// Parse the number after 'key', which must be next in the line
+static int parse_next_field(const char **pp, const char *end, const char *key,
+                            unsigned *val)
+{
+    const char *p = *pp;
+    size_t len = strlen(key);
+
+    while (p < end && *p == ' ')
+        ++p;
+    if ((size_t)(end - p) < len || memcmp(p, key, len))
+        return -1;
+    *pp = p + len;
+    return parse_uint(pp, end, val);
+}
+
+// Same, for a fixed-point number with two decimal places, as hundredths
+static int parse_next_frac(const char **pp, const char *end, const char *key,
+                           unsigned *val)
+{
+    const char *p;
+    unsigned whole;
+
+    if (parse_next_field(pp, end, key, &whole))
+        return -1;
+    p = *pp;
+    if (end - p < 3 || *p != '.' ||
+        p[1] < '0' || p[1] > '9' || p[2] < '0' || p[2] > '9')
+        return -1;
+    *val = whole * 100 + (p[1] - '0') * 10 + (p[2] - '0');
+    *pp = p + 3;
+    return 0;
+}
+
+// The fields are in the order printed by task_print
+static int parse_summary(struct summary *s, const char *p, const char *eol)
+{
+    p += strlen("summary:");
+    return parse_next_field(&p, eol, "samples", &s->samples) ||
+           parse_next_field(&p, eol, "min", &s->min) ||
+           parse_next_field(&p, eol, "max", &s->max) ||
+           parse_next_frac(&p, eol, "mean", &s->mean_x100) ||
+           parse_next_field(&p, eol, "first", &s->first) ||
+           parse_next_field(&p, eol, "last", &s->last) ||
+           parse_next_field(&p, eol, "threshold", &s->threshold) ||
+           parse_next_field(&p, eol, "crossings", &s->crossings) ? -1 : 0;
+}
+
+static int hex_digit(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+// A line of symbols: hex numbers separated by whitespace
+static int is_data_line(const char *p, const char *end)
+{
+    for (; p < end; ++p)
+        if (hex_digit(*p) < 0 && *p != ' ' && *p != '\r' && *p != '\t')
+            return 0;
+    return 1;
+}
+
+// Parse the next symbol, returns 0 when there are no more
+static int next_symbol(const char **pp, const char *end, unsigned *sym)
+{
+    const char *p = *pp;
+    unsigned v = 0;
+    int d;
+
+    while (p < end && hex_digit(*p) < 0)
+        ++p;
+    if (p == end)
+        return 0;
+    while (p < end && (d = hex_digit(*p)) >= 0) {
+        v = (v << 4) | d;
+        ++p;
+    }
+    *sym = v;
+    *pp = p;
+    return 1;
+}
+
+// Parse one block starting after its marker line, returns the end of the
+// block or NULL if it is incomplete or malformed. Unless 'count_symbols', the
+// symbol lines are skipped over without parsing them.
+static const char *parse_block(struct block *b, const char *p, const char *end,
+                               int count_symbols)
+{
+    unsigned block_size;
+    int have_stats = 0;
+
+    memset(b, 0, sizeof(*b));
+    b->quant_step = 1;
+
+    while (p < end) {
+        const char *eol = line_end(p, end);
+
+        if (starts_with(p, eol, BLOCK_MARKER)) {
+            return NULL; // next block started before this one was complete
+        } else if (starts_with(p, eol, "seq:")) {
+            const char *q = p + strlen("seq:");
+            unsigned letters;
+            if (parse_next_field(&q, eol, "block", &b->seq) ||
+                parse_next_field(&q, eol, "offset", &b->epoch_offset) ||
+                parse_next_field(&q, eol, "letters", &letters))
+                return NULL;
+            b->letters_before = letters; // until unwrapped, see log_index
+            b->has_seq = 1;
+        } else if (starts_with(p, eol, "quant:")) {
+            const char *q = p + strlen("quant:");
+            if (parse_next_field(&q, eol, "step", &b->quant_step) ||
+                !b->quant_step)
+                return NULL;
+        } else if (starts_with(p, eol, "stats:")) {
+            const char *q = p + strlen("stats:");
+            unsigned node_count;
+            if (parse_next_field(&q, eol, "nodes", &node_count) ||
+                q == eol || *q++ != '/' ||
+                parse_uint(&q, eol, &b->dict_size) ||
+                parse_field(p, eol, "resets", &b->epoch))
+                return NULL;
+            have_stats = 1;
+        } else if (starts_with(p, eol, "summary:")) {
+            if (parse_summary(&b->summary, p, eol))
+                return NULL;
+            b->has_summary = 1;
+        } else if (starts_with(p, eol, "rate:")) {
+            const char *q = p + strlen("rate:");
+            if (!b->symbols || !have_stats ||
+                parse_next_field(&q, eol, "samples/block:", &b->letters) ||
+                q == eol || *q++ != '/' ||
+                parse_uint(&q, eol, &block_size) ||
+                (count_symbols && block_size != b->num_symbols))
+                return NULL;
+            b->num_symbols = block_size;
+            b->symbols_end = p;
+            return eol;
+        } else if (have_stats && is_data_line(p, eol)) {
+            const char *q = p;
+            unsigned sym;
+            if (!b->symbols)
+                b->symbols = p;
+            if (count_symbols) {
+                while (next_symbol(&q, eol, &sym))
+                    b->num_symbols++;
+            } else {
+                // The symbols are followed by the first line with a colon
+                const char *colon = memchr(p, ':', end - p);
+                if (!colon)
+                    return NULL;
+                while (colon > p && colon[-1] != '\n')
+                    --colon;
+                eol = colon - 1;
+            }
+        }
+        p = eol < end ? eol + 1 : end;
+    }
+    return NULL;
+}
+
+static int index_blocks(struct log *log, int count_symbols)
+{
+    const char *p = log->data, *end = log->data + log->size;
+    unsigned cap = 0;
+
+    while (p < end) {
+        const char *marker = starts_with(p, end, BLOCK_MARKER) ? p :
+                             memmem(p, end - p, BLOCK_MARKER,
+                                    strlen(BLOCK_MARKER));
+        const char *next;
+        struct block b;
+
+        if (!marker)
+            break;
+        p = line_end(marker, end);
+        p = p < end ? p + 1 : end;
+
+        next = parse_block(&b, p, end, count_symbols);
+        if (!next) {
+            fprintf(stderr, "%s: skipping malformed block at offset %zu\n",
+                    log->name, (size_t)(marker - log->data));
+            continue;
+        }
+        p = next;
+
+        if (log->num_blocks == cap) {
+            struct block *blocks;
+            cap = cap ? cap * 2 : 64;
+            blocks = realloc(log->blocks, cap * sizeof(*blocks));
+            if (!blocks)
+                return -1;
+            log->blocks = blocks;
+        }
+        log->blocks[log->num_blocks++] = b;
+    }
+    return 0;
+}
+
+// Count the lost blocks and unwrap the letter counters. Logs from before the
+// block numbers were printed are assumed to have no blocks lost.
+static void sequence_blocks(struct log *log)
+{
+    size_t letters = 0;
+    unsigned i;
+
+    for (i = 0; i < log->num_blocks; ++i) {
+        struct block *b = &log->blocks[i];
+
+        if (!b->has_seq) {
+            b->seq = i;
+            b->letters_before = letters;
+        } else if (i > 0 && b->letters_before <= COUNTER_MASK) {
+            // The letters since the previous block, counted modulo 2^16
+            log->lost_blocks += (b->seq - b[-1].seq - 1) & COUNTER_MASK;
+            b->letters_before = b[-1].letters_before +
+                ((b->letters_before - b[-1].letters_before) & COUNTER_MASK);
+        } else if (i > 0) {
+            log->lost_blocks += b->seq - b[-1].seq - 1;
+        } else {
+            log->lost_blocks += b->seq; // the first blocks
+        }
+        letters = b->letters_before + b->letters;
+    }
+}
+
+// A log that failed to index is left without blocks, rather than with a
+// prefix of them that would be reported as the whole log
+static int index_failed(struct log *log)
+{
+    log->error = "out of memory";
+    log->num_blocks = 0;
+    return -1;
+}
+
+int log_index(struct log *log)
+{
+    if (index_blocks(log, 1))
+        return index_failed(log);
+    sequence_blocks(log);
+    return 0;
+}
+
+int log_index_headers(struct log *log)
+{
+    if (index_blocks(log, 0))
+        return index_failed(log);
+    sequence_blocks(log);
+    return 0;
+}
+
+#define INDEX_MAGIC "blkidx1"
+
+struct index_header {
+    char magic[8];
+    uint64_t log_size;
+    int64_t mtime_sec, mtime_nsec;
+    uint32_t num_blocks;
+    uint32_t lost_blocks;
+};
+
+// A block header, with its symbols as offsets into the log
+struct index_record {
+    uint64_t symbols, symbols_end;
+    uint64_t letters_before;
+    uint32_t num_symbols, letters, quant_step, dict_size;
+    uint32_t epoch, seq, epoch_offset;
+    uint8_t has_seq, has_summary;
+    struct summary summary;
+};
+
+static char *index_path(const struct log *log, const char *suffix)
+{
+    size_t len = strlen(log->path) + strlen(".idx") + strlen(suffix) + 1;
+    char *path = malloc(len);
+
+    if (path)
+        snprintf(path, len, "%s.idx%s", log->path, suffix);
+    return path;
+}
+
+int log_load_index(struct log *log)
+{
+    char *path = index_path(log, "");
+    struct index_header hdr;
+    struct index_record *recs = NULL;
+    FILE *f = NULL;
+    unsigned i;
+    int rc = -1;
+
+    if (!path || !(f = fopen(path, "rb")))
+        goto out;
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+        memcmp(hdr.magic, INDEX_MAGIC, sizeof(hdr.magic)) ||
+        hdr.log_size != log->size ||
+        hdr.mtime_sec != log->mtime.tv_sec ||
+        hdr.mtime_nsec != log->mtime.tv_nsec)
+        goto out;
+
+    recs = malloc((hdr.num_blocks + 1) * sizeof(*recs));
+    log->blocks = calloc(hdr.num_blocks + 1, sizeof(*log->blocks));
+    if (!recs || !log->blocks ||
+        fread(recs, sizeof(*recs), hdr.num_blocks, f) != hdr.num_blocks)
+        goto out;
+
+    for (i = 0; i < hdr.num_blocks; ++i) {
+        const struct index_record *r = &recs[i];
+        struct block *b = &log->blocks[i];
+
+        if (r->symbols > r->symbols_end || r->symbols_end > log->size)
+            goto out;
+        b->symbols = log->data + r->symbols;
+        b->symbols_end = log->data + r->symbols_end;
+        b->num_symbols = r->num_symbols;
+        b->letters = r->letters;
+        b->quant_step = r->quant_step;
+        b->dict_size = r->dict_size;
+        b->epoch = r->epoch;
+        b->seq = r->seq;
+        b->epoch_offset = r->epoch_offset;
+        b->letters_before = r->letters_before;
+        b->has_seq = r->has_seq;
+        b->has_summary = r->has_summary;
+        b->summary = r->summary;
+    }
+    log->num_blocks = hdr.num_blocks;
+    log->lost_blocks = hdr.lost_blocks;
+    rc = 0;
+
+out:
+    if (rc) {
+        free(log->blocks);
+        log->blocks = NULL;
+    }
+    if (f)
+        fclose(f);
+    free(recs);
+    free(path);
+    return rc;
+}
+
+int log_save_index(const struct log *log)
+{
+    char *path = index_path(log, ""), *tmp = index_path(log, ".tmp");
+    struct index_header hdr;
+    FILE *f = NULL;
+    unsigned i;
+    int rc = -1;
+
+    if (!path || !tmp)
+        goto out;
+    f = fopen(tmp, "wb");
+    if (!f) {
+        fprintf(stderr, "%s: %s\n", tmp, strerror(errno));
+        goto out;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, INDEX_MAGIC, sizeof(hdr.magic));
+    hdr.log_size = log->size;
+    hdr.mtime_sec = log->mtime.tv_sec;
+    hdr.mtime_nsec = log->mtime.tv_nsec;
+    hdr.num_blocks = log->num_blocks;
+    hdr.lost_blocks = log->lost_blocks;
+    if (fwrite(&hdr, sizeof(hdr), 1, f) != 1)
+        goto write_error;
+
+    for (i = 0; i < log->num_blocks; ++i) {
+        const struct block *b = &log->blocks[i];
+        struct index_record r;
+
+        memset(&r, 0, sizeof(r)); // no uninitialized padding in the file
+        r.symbols = b->symbols - log->data;
+        r.symbols_end = b->symbols_end - log->data;
+        r.num_symbols = b->num_symbols;
+        r.letters = b->letters;
+        r.quant_step = b->quant_step;
+        r.dict_size = b->dict_size;
+        r.epoch = b->epoch;
+        r.seq = b->seq;
+        r.epoch_offset = b->epoch_offset;
+        r.letters_before = b->letters_before;
+        r.has_seq = b->has_seq;
+        r.has_summary = b->has_summary;
+        r.summary = b->summary;
+        if (fwrite(&r, sizeof(r), 1, f) != 1)
+            goto write_error;
+    }
+
+    if (fclose(f)) {
+        f = NULL;
+        goto write_error;
+    }
+    f = NULL;
+    // Readers see either no index or a complete one
+    if (rename(tmp, path)) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        goto out;
+    }
+    rc = 0;
+    goto out;
+
+write_error:
+    fprintf(stderr, "%s: %s\n", tmp, strerror(errno));
+out:
+    if (f)
+        fclose(f);
+    if (rc && tmp)
+        unlink(tmp);
+    free(path);
+    free(tmp);
+    return rc;
+}
+
+// The block follows the previous one in the log without lost blocks between
+static int block_follows(const struct block *b)
+{
+    return !b->has_seq || ((b->seq - b[-1].seq) & COUNTER_MASK) == 1;
+}
+
+unsigned log_epochs(struct log *log, struct epoch *epochs)
+{
+    unsigned num_epochs = 0, i;
+
+    for (i = 0; i < log->num_blocks; ++i) {
+        const struct block *b = &log->blocks[i];
+
+        if (i == 0 || b->epoch != b[-1].epoch || !block_follows(b)) {
+            if (epochs) {
+                struct epoch *e = &epochs[num_epochs];
+                memset(e, 0, sizeof(*e));
+                e->log = log;
+                e->first_block = i;
+                e->incomplete = b->has_seq && b->epoch_offset != 0;
+            }
+            num_epochs++;
+        }
+        if (epochs)
+            epochs[num_epochs - 1].num_blocks++;
+    }
+    return num_epochs;
+}
+
+static int append_phrase(struct epoch *epoch, size_t *cap,
+                         const struct lzw_node *dict, unsigned sym)
+{
+    uint32_t len = dict[sym].len, i;
+
+    if (epoch->num_letters + len > *cap) {
+        uint8_t *letters;
+        *cap = (epoch->num_letters + len) * 2;
+        letters = realloc(epoch->letters, *cap);
+        if (!letters)
+            return -1;
+        epoch->letters = letters;
+    }
+
+    // Walk from the last letter of the phrase back to its root
+    for (i = len; i > 0; --i) {
+        epoch->letters[epoch->num_letters + i - 1] = dict[sym].letter;
+        sym = dict[sym].prefix;
+    }
+    epoch->num_letters += len;
+    return 0;
+}
+
+int epoch_decode(struct epoch *epoch)
+{
+    const struct block *blocks = &epoch->log->blocks[epoch->first_block];
+    unsigned dict_size = blocks[0].dict_size;
+    unsigned next = NUM_LETTERS, prev = NO_SYMBOL, sym, i;
+    struct lzw_node *dict;
+    size_t cap = 0;
+
+    if (dict_size < NUM_LETTERS || dict_size > UINT16_MAX + 1) {
+        epoch->error = "bad dictionary size";
+        return -1;
+    }
+    dict = malloc(dict_size * sizeof(*dict));
+    if (!dict) {
+        epoch->error = "out of memory";
+        return -1;
+    }
+
+    for (i = 0; i < NUM_LETTERS; ++i) {
+        dict[i].prefix = 0;
+        dict[i].letter = dict[i].first = i;
+        dict[i].len = 1;
+    }
+    for (i = 0; i < epoch->num_blocks; ++i)
+        cap += blocks[i].letters;
+    epoch->letters = malloc(cap ? cap : 1);
+    if (!epoch->letters) {
+        epoch->error = "out of memory";
+        goto out;
+    }
+
+    // Mirrors task_add_insert: after each symbol but the first, the node
+    // (previous phrase + first letter of this phrase) was added to the
+    // dictionary, at the next free index.
+    for (i = 0; i < epoch->num_blocks && !epoch->error; ++i) {
+        const char *p = blocks[i].symbols;
+
+        while (next_symbol(&p, blocks[i].symbols_end, &sym)) {
+            if (sym >= next + (prev != NO_SYMBOL) || sym >= dict_size) {
+                epoch->error = "symbol not in dictionary";
+                break;
+            }
+            if (prev != NO_SYMBOL) {
+                if (next == dict_size) {
+                    epoch->error = "dictionary overflow";
+                    break;
+                }
+                dict[next].prefix = prev;
+                dict[next].first = dict[prev].first;
+                dict[next].len = dict[prev].len + 1;
+                // When the symbol is the node being added, its first letter
+                // is the first letter of the previous phrase
+                dict[next].letter = sym == next ? dict[prev].first :
+                                                  dict[sym].first;
+                next++;
+            }
+            if (append_phrase(epoch, &cap, dict, sym)) {
+                epoch->error = "out of memory";
+                break;
+            }
+            prev = sym;
+        }
+    }
+
+out:
+    free(dict);
+    return epoch->error ? -1 : 0;
+}
+
+void epoch_free(struct epoch *epoch)
+{
+    free(epoch->letters);
+    epoch->letters = NULL;
+    epoch->num_letters = 0;
+}
+
+size_t epochs_samples(const struct epoch *epochs, unsigned num_epochs,
+                      uint32_t *samples, size_t *indices)
+{
+    size_t num_samples = 0, sample_idx = 0, i;
+    unsigned e, have = 0; // letters of the sample so far
+    uint32_t sample = 0;
+
+    for (e = 0; e < num_epochs; ++e) {
+        const struct epoch *epoch = &epochs[e];
+        const struct block *first = &epoch->log->blocks[epoch->first_block];
+        size_t pos = block_letter_pos(first);
+
+        for (i = 0; i < epoch->num_letters; ++i) {
+            size_t letter_pos = pos + i;
+            unsigned letter_idx;
+
+            // The stream starts with a fixed '0' letter (see task_init)
+            if (letter_pos == 0)
+                continue;
+            letter_idx = (letter_pos - 1) % NUM_LETTERS_IN_SAMPLE;
+            if (letter_idx == 0) {
+                sample_idx = (letter_pos - 1) / NUM_LETTERS_IN_SAMPLE;
+                sample = 0;
+                have = 0;
+            } else if (have != letter_idx ||
+                       sample_idx != (letter_pos - 1) / NUM_LETTERS_IN_SAMPLE) {
+                continue; // the first letters of the sample were lost
+            }
+
+            // Letters of a sample are in order from the least significant
+            sample |= (uint32_t)epoch->letters[i] <<
+                      (LETTER_SIZE_BITS * letter_idx);
+            if (++have == NUM_LETTERS_IN_SAMPLE) {
+                if (samples)
+                    samples[num_samples] = sample * first->quant_step;
+                if (indices)
+                    indices[num_samples] = sample_idx;
+                num_samples++;
+            }
+        }
+    }
+    return num_samples;
+}
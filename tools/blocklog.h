@@ -0,0 +1,115 @@
+#ifndef BLOCKLOG_H
+#define BLOCKLOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// Format of the compressed stream (see src/main.c)
+#define NUM_LETTERS             256
+#define NUM_LETTERS_IN_SAMPLE     2
+#define LETTER_SIZE_BITS          8
+
+// Summary of the samples measured during a block (before quantization)
+struct summary {
+    unsigned samples;
+    unsigned min;
+    unsigned max;
+    unsigned mean_x100;      // mean, in hundredths
+    unsigned first;
+    unsigned last;
+    unsigned threshold;
+    unsigned crossings;      // samples that reached the threshold from below
+};
+
+// A block as printed by task_print, located in the mapped log
+struct block {
+    const char *symbols;     // first symbol of the block
+    const char *symbols_end;
+    unsigned num_symbols;
+    unsigned letters;        // letters compressed into the block
+    unsigned quant_step;
+    unsigned dict_size;
+    unsigned epoch;          // dictionary resets before this block
+    unsigned seq;            // block number on the device
+    unsigned epoch_offset;   // blocks since the dictionary reset
+    size_t letters_before;   // compressed by the device before this block
+    int has_seq;
+    int has_summary;
+    struct summary summary;
+};
+
+// The log offloaded from one device, mapped into memory
+struct log {
+    char *name;              // device name (file name without extension)
+    char *path;
+    const char *data;
+    size_t size;
+    struct timespec mtime;   // of the file, to tell if its index is stale
+    struct block *blocks;
+    unsigned num_blocks;
+    unsigned lost_blocks;    // missing from the log, by their numbers
+    const char *error;       // reason indexing failed (no blocks), or NULL
+};
+
+// A run of blocks compressed with one dictionary, decodable on its own
+struct epoch {
+    struct log *log;
+    unsigned first_block;
+    unsigned num_blocks;
+    int incomplete;          // its first blocks were lost, can't be decoded
+    uint8_t *letters;        // decoded output
+    size_t num_letters;
+    const char *error;       // reason decoding stopped early, or NULL
+};
+
+// Position of the first decoded letter of the block in the device's stream
+// (where the fixed prefix is at 0): the letters compressed before the block,
+// but the last one, which started the phrase in progress at the boundary
+static inline size_t block_letter_pos(const struct block *b)
+{
+    return b->letters_before ? b->letters_before - 1 : 0;
+}
+
+// Index of the first sample measured during the block
+static inline size_t block_first_sample(const struct block *b)
+{
+    return b->letters_before / NUM_LETTERS_IN_SAMPLE;
+}
+
+int log_open(struct log *log, const char *path);
+void log_close(struct log *log);
+
+// Locate the blocks in the log and parse their headers
+int log_index(struct log *log);
+
+// Same, but only check the structure of the blocks, not their symbols (which
+// epoch_decode checks), which is much faster when only the headers are needed
+int log_index_headers(struct log *log);
+
+// Load the headers indexed by log_index_headers from the sidecar index file
+// of the log (<log>.idx), without reading the log. Fails if there is none,
+// or if the log has changed since (by its size and modification time).
+int log_load_index(struct log *log);
+
+// Write the sidecar index of a log indexed by log_index_headers
+int log_save_index(const struct log *log);
+
+// Split the indexed log into epochs, returns the number of epochs; 'epochs'
+// may be NULL to only count them. Lost blocks split an epoch, and the part
+// after them is incomplete.
+unsigned log_epochs(struct log *log, struct epoch *epochs);
+
+// Decode the letters of the epoch, returns 0 on success
+int epoch_decode(struct epoch *epoch);
+void epoch_free(struct epoch *epoch);
+
+// Convert the decoded letters of the epochs of a log into samples, dropping
+// the samples with letters in lost or undecodable blocks. Returns the number
+// of samples stored into 'samples' (which may be NULL to only count them),
+// and their indices in the device's stream of samples into 'indices' (if not
+// NULL), which skip over the dropped samples.
+size_t epochs_samples(const struct epoch *epochs, unsigned num_epochs,
+                      uint32_t *samples, size_t *indices);
+
+#endif // BLOCKLOG_H
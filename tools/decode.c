@@ -0,0 +1,237 @@
+// Bulk decoder for compressed temperature logs offloaded from a fleet of
+// devices: one log file per device, as printed by the app's console.
+//
+// Epochs (runs of blocks between dictionary resets) decode independently of
+// each other, so they are decoded in parallel across all devices.
+//
+// Blocks lost on the way from a device are detected by their numbers: the
+// rest of their epoch can't be decoded, and decoding resumes at the next one.
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "blocklog.h"
+#include "pool.h"
+#include "util.h"
+
+struct decoder {
+    struct log *logs;
+    unsigned num_logs;
+    struct epoch *epochs;   // of all logs, grouped by log, in order
+    unsigned *first_epoch;  // index of the first epoch of each log
+    unsigned num_epochs;
+    unsigned *order;        // epochs by decreasing size, for scheduling
+};
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-j threads] [-o dir] log...\n"
+            "\n"
+            "  -j threads  number of decoder threads (default: CPU count)\n"
+            "  -o dir      write the samples of each device to dir/<device>.txt,\n"
+            "              as lines of '<sample index> <value>'\n",
+            prog);
+}
+
+static void index_job(void *arg, unsigned job)
+{
+    struct decoder *dec = arg;
+
+    log_index(&dec->logs[job]); // failure recorded in the log
+}
+
+static void decode_job(void *arg, unsigned job)
+{
+    struct decoder *dec = arg;
+    struct epoch *epoch = &dec->epochs[dec->order[job]];
+
+    if (!epoch->incomplete)
+        epoch_decode(epoch);
+}
+
+static const struct epoch *sort_epochs;
+
+static int cmp_epoch_size(const void *a, const void *b)
+{
+    const struct epoch *ea = &sort_epochs[*(const unsigned *)a];
+    const struct epoch *eb = &sort_epochs[*(const unsigned *)b];
+    return (int)eb->num_blocks - (int)ea->num_blocks;
+}
+
+// The samples lost with their blocks leave gaps in the indices
+static int write_samples(const char *dir, const struct log *log,
+                         const uint32_t *samples, const size_t *indices,
+                         size_t num_samples)
+{
+    size_t len = strlen(dir) + strlen(log->name) + 6;
+    char *path = malloc(len);
+    FILE *f;
+    size_t i;
+
+    if (!path)
+        return -1;
+    snprintf(path, len, "%s/%s.txt", dir, log->name);
+    f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        free(path);
+        return -1;
+    }
+    for (i = 0; i < num_samples; ++i)
+        fprintf(f, "%zu %u\n", indices[i], samples[i]);
+    fclose(f);
+    free(path);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    struct decoder dec = { 0 };
+    unsigned num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *out_dir = NULL;
+    size_t bytes = 0, letters = 0, samples = 0;
+    unsigned blocks = 0, failed = 0, lost = 0, undecodable = 0, i, e;
+    double start, elapsed;
+    int opt, rc = 0;
+
+    while ((opt = getopt(argc, argv, "j:o:h")) != -1) {
+        switch (opt) {
+            case 'j':
+                if (parse_uint_arg(optarg, 1, &num_threads)) {
+                    fprintf(stderr, "%s: invalid thread count: %s\n",
+                            argv[0], optarg);
+                    return 1;
+                }
+                break;
+            case 'o':
+                out_dir = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind == argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    dec.num_logs = argc - optind;
+    dec.logs = calloc(dec.num_logs, sizeof(*dec.logs));
+    dec.first_epoch = calloc(dec.num_logs + 1, sizeof(*dec.first_epoch));
+    if (!dec.logs || !dec.first_epoch) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    for (i = 0; i < dec.num_logs; ++i) {
+        if (log_open(&dec.logs[i], argv[optind + i]))
+            return 1;
+        bytes += dec.logs[i].size;
+    }
+
+    start = now();
+
+    if (pool_run(num_threads, dec.num_logs, index_job, &dec)) {
+        fprintf(stderr, "failed to start the indexing threads\n");
+        return 1;
+    }
+
+    for (i = 0; i < dec.num_logs; ++i) {
+        if (dec.logs[i].error) {
+            fprintf(stderr, "%s: failed to index: %s\n", dec.logs[i].name,
+                    dec.logs[i].error);
+            rc = 1;
+        }
+        dec.first_epoch[i] = dec.num_epochs;
+        dec.num_epochs += log_epochs(&dec.logs[i], NULL);
+        blocks += dec.logs[i].num_blocks;
+    }
+    dec.first_epoch[dec.num_logs] = dec.num_epochs;
+
+    dec.epochs = calloc(dec.num_epochs, sizeof(*dec.epochs));
+    dec.order = calloc(dec.num_epochs, sizeof(*dec.order));
+    if (!dec.epochs || !dec.order) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    for (i = 0; i < dec.num_logs; ++i)
+        log_epochs(&dec.logs[i], &dec.epochs[dec.first_epoch[i]]);
+    for (e = 0; e < dec.num_epochs; ++e)
+        dec.order[e] = e;
+    sort_epochs = dec.epochs;
+    qsort(dec.order, dec.num_epochs, sizeof(*dec.order), cmp_epoch_size);
+
+    if (pool_run(num_threads, dec.num_epochs, decode_job, &dec)) {
+        fprintf(stderr, "failed to start the decoder threads\n");
+        return 1;
+    }
+
+    elapsed = now() - start;
+
+    for (i = 0; i < dec.num_logs; ++i) {
+        struct log *log = &dec.logs[i];
+        struct epoch *epochs = &dec.epochs[dec.first_epoch[i]];
+        unsigned num_epochs = dec.first_epoch[i + 1] - dec.first_epoch[i];
+        uint32_t *log_samples = NULL;
+        size_t *indices = NULL;
+        size_t num_samples;
+
+        lost += log->lost_blocks;
+        for (e = 0; e < num_epochs; ++e) {
+            if (epochs[e].incomplete)
+                undecodable += epochs[e].num_blocks;
+            letters += epochs[e].num_letters;
+            if (epochs[e].error) {
+                fprintf(stderr, "%s: epoch %u: %s\n", log->name,
+                        log->blocks[epochs[e].first_block].epoch,
+                        epochs[e].error);
+                failed++;
+            }
+        }
+
+        num_samples = epochs_samples(epochs, num_epochs, NULL, NULL);
+        samples += num_samples;
+
+        if (out_dir) {
+            log_samples = malloc((num_samples + 1) * sizeof(*log_samples));
+            indices = malloc((num_samples + 1) * sizeof(*indices));
+            if (!log_samples || !indices) {
+                fprintf(stderr, "out of memory\n");
+                return 1;
+            }
+            epochs_samples(epochs, num_epochs, log_samples, indices);
+            if (write_samples(out_dir, log, log_samples, indices, num_samples))
+                rc = 1;
+            free(log_samples);
+            free(indices);
+        }
+    }
+
+    printf("devices: %u epochs: %u blocks: %u threads: %u\n",
+           dec.num_logs, dec.num_epochs, blocks, num_threads);
+    printf("decoded: %zu samples (%zu letters) from %.2f MB in %.3f s\n",
+           samples, letters, bytes / 1e6, elapsed);
+    printf("throughput: %.2f MB/s, %.0f samples/s\n",
+           bytes / 1e6 / elapsed, samples / elapsed);
+    if (lost)
+        printf("lost: %u blocks, undecodable: %u blocks (after a loss, until "
+               "the next epoch)\n", lost, undecodable);
+    if (failed) {
+        printf("failed epochs: %u\n", failed);
+        rc = 1;
+    }
+
+    for (e = 0; e < dec.num_epochs; ++e)
+        epoch_free(&dec.epochs[e]);
+    for (i = 0; i < dec.num_logs; ++i)
+        log_close(&dec.logs[i]);
+    free(dec.epochs);
+    free(dec.order);
+    free(dec.first_epoch);
+    free(dec.logs);
+    return rc;
+}
@@ -0,0 +1,116 @@
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "pool.h"
+
+// Jobs of one worker: the owner takes from the head, thieves from the tail
+struct deque {
+    pthread_mutex_t lock;
+    unsigned *jobs;
+    unsigned head, tail;
+};
+
+struct worker {
+    pthread_t thread;
+    struct pool *pool;
+    unsigned idx;
+};
+
+struct pool {
+    unsigned num_workers;
+    struct deque *deques;
+    pool_job_t job;
+    void *arg;
+};
+
+static int take(struct deque *dq, unsigned *job, int steal)
+{
+    int found = 0;
+
+    pthread_mutex_lock(&dq->lock);
+    if (dq->head != dq->tail) {
+        *job = steal ? dq->jobs[--dq->tail] : dq->jobs[dq->head++];
+        found = 1;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return found;
+}
+
+static void *worker_main(void *arg)
+{
+    struct worker *w = arg;
+    struct pool *pool = w->pool;
+    unsigned job = 0, i;
+
+    for (;;) {
+        if (!take(&pool->deques[w->idx], &job, 0)) {
+            // No new jobs are ever added, so once every deque is seen
+            // empty there is nothing left to do
+            for (i = 1; i < pool->num_workers; ++i)
+                if (take(&pool->deques[(w->idx + i) % pool->num_workers],
+                         &job, 1))
+                    break;
+            if (i == pool->num_workers)
+                break;
+        }
+        pool->job(pool->arg, job);
+    }
+    return NULL;
+}
+
+int pool_run(unsigned num_workers, unsigned num_jobs,
+             pool_job_t job, void *arg)
+{
+    struct pool pool = { .num_workers = num_workers, .job = job, .arg = arg };
+    struct worker *workers;
+    unsigned i;
+    int rc = 0;
+
+    if (num_workers == 0)
+        num_workers = pool.num_workers = 1;
+
+    pool.deques = calloc(num_workers, sizeof(*pool.deques));
+    workers = calloc(num_workers, sizeof(*workers));
+    if (!pool.deques || !workers) {
+        rc = -1;
+        goto out;
+    }
+
+    for (i = 0; i < num_workers; ++i)
+        pthread_mutex_init(&pool.deques[i].lock, NULL);
+
+    for (i = 0; i < num_workers; ++i) {
+        struct deque *dq = &pool.deques[i];
+        dq->jobs = malloc((num_jobs / num_workers + 1) * sizeof(*dq->jobs));
+        if (!dq->jobs) {
+            rc = -1;
+            goto out;
+        }
+    }
+    for (i = 0; i < num_jobs; ++i) {
+        struct deque *dq = &pool.deques[i % num_workers];
+        dq->jobs[dq->tail++] = i;
+    }
+
+    for (i = 0; i < num_workers; ++i) {
+        workers[i].pool = &pool;
+        workers[i].idx = i;
+        if (pthread_create(&workers[i].thread, NULL, worker_main, &workers[i])) {
+            rc = -1;
+            break;
+        }
+    }
+    while (i--)
+        pthread_join(workers[i].thread, NULL);
+
+out:
+    if (pool.deques) {
+        for (i = 0; i < num_workers; ++i) {
+            pthread_mutex_destroy(&pool.deques[i].lock);
+            free(pool.deques[i].jobs);
+        }
+    }
+    free(pool.deques);
+    free(workers);
+    return rc;
+}
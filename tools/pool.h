@@ -0,0 +1,12 @@
+#ifndef POOL_H
+#define POOL_H
+
+typedef void (*pool_job_t)(void *arg, unsigned job);
+
+// Run jobs 0..num_jobs-1 on a pool of worker threads and wait for them. Jobs
+// are dealt round-robin to the workers in index order (so put the expensive
+// ones first); a worker that runs out of jobs steals from the others.
+int pool_run(unsigned num_workers, unsigned num_jobs,
+             pool_job_t job, void *arg);
+
+#endif // POOL_H
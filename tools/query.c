@@ -0,0 +1,405 @@
+// Query the compressed temperature logs of a fleet by the summaries in the
+// block headers, without decoding them, e.g. which shipments went above a
+// temperature limit:
+//
+//   query -a <limit in ADC counts> log...
+//
+// The headers of each log are indexed into a sidecar file (<log>.idx) on the
+// first query, so that later queries read only the index, not the log, until
+// the log changes.
+//
+// Only the matching blocks are decoded (-d), which takes decoding their
+// epochs up to them, since each symbol refers to the dictionary built by the
+// symbols before it.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "blocklog.h"
+#include "pool.h"
+#include "util.h"
+
+struct predicate {
+    int above, below, crossings;
+    unsigned max_above;    // max > max_above
+    unsigned min_below;    // min < min_below
+};
+
+// Positions of a log's blocks in the streams of letters and samples, from
+// the block headers
+struct log_pos {
+    size_t *letter_start;  // first decoded letter of each block
+    size_t *sample_start;  // first sample summarized by each block
+    struct epoch *epochs;
+    unsigned num_epochs;
+    unsigned *block_epoch; // epoch of each block
+};
+
+struct query {
+    struct log *logs;
+    struct log_pos *pos;
+    unsigned num_logs;
+    unsigned char *from_index; // logs whose headers were in their index
+    struct epoch **jobs;   // epoch prefixes to decode
+    unsigned num_jobs;
+};
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-a count] [-b count] [-x] [-d] [-j threads] log...\n"
+            "\n"
+            "Lists the blocks whose summary matches all the given conditions.\n"
+            "The block headers of each log are kept in <log>.idx for the\n"
+            "next queries.\n"
+            "\n"
+            "  -a count    max sample above count (in ADC counts)\n"
+            "  -b count    min sample below count\n"
+            "  -x          samples crossed the device's threshold upwards\n"
+            "  -d          decode the matching blocks and print their samples\n"
+            "  -j threads  number of threads (default: CPU count)\n",
+            prog);
+}
+
+static int matches(const struct predicate *pred, const struct block *b)
+{
+    const struct summary *s = &b->summary;
+
+    if (!b->has_summary)
+        return 0;
+    return (!pred->above || s->max > pred->max_above) &&
+           (!pred->below || s->min < pred->min_below) &&
+           (!pred->crossings || s->crossings > 0);
+}
+
+static void index_job(void *arg, unsigned job)
+{
+    struct query *q = arg;
+
+    struct log *log = &q->logs[job];
+
+    if (!log_load_index(log)) {
+        q->from_index[job] = 1;
+        return;
+    }
+    if (log_index_headers(log)) // failure recorded in the log
+        return;
+    if (log_save_index(log))
+        fprintf(stderr, "%s: index not saved\n", log->name);
+}
+
+static void decode_job(void *arg, unsigned job)
+{
+    struct query *q = arg;
+
+    epoch_decode(q->jobs[job]);
+}
+
+static int log_pos_init(struct log_pos *pos, struct log *log)
+{
+    unsigned i, e;
+
+    memset(pos, 0, sizeof(*pos));
+    pos->num_epochs = log_epochs(log, NULL);
+    pos->letter_start = calloc(log->num_blocks + 1, sizeof(size_t));
+    pos->sample_start = calloc(log->num_blocks + 1, sizeof(size_t));
+    pos->block_epoch = calloc(log->num_blocks + 1, sizeof(unsigned));
+    pos->epochs = calloc(pos->num_epochs + 1, sizeof(struct epoch));
+    if (!pos->letter_start || !pos->sample_start || !pos->block_epoch ||
+        !pos->epochs)
+        return -1;
+    log_epochs(log, pos->epochs);
+
+    for (i = 0; i < log->num_blocks; ++i) {
+        pos->letter_start[i] = block_letter_pos(&log->blocks[i]);
+        pos->sample_start[i] = block_first_sample(&log->blocks[i]);
+    }
+    for (e = 0; e < pos->num_epochs; ++e)
+        for (i = 0; i < pos->epochs[e].num_blocks; ++i)
+            pos->block_epoch[pos->epochs[e].first_block + i] = e;
+    return 0;
+}
+
+static void log_pos_free(struct log_pos *pos)
+{
+    unsigned e;
+
+    for (e = 0; e < pos->num_epochs; ++e)
+        epoch_free(&pos->epochs[e]);
+    free(pos->letter_start);
+    free(pos->sample_start);
+    free(pos->block_epoch);
+    free(pos->epochs);
+}
+
+// Shorten the epoch of the block to a prefix that includes the block
+static void need_block(struct log_pos *pos, unsigned block, unsigned *needed)
+{
+    unsigned e = pos->block_epoch[block];
+    unsigned len = block - pos->epochs[e].first_block + 1;
+
+    if (len > needed[e])
+        needed[e] = len;
+}
+
+// Look up a letter, by position in the stream, in the decoded epochs
+static int letter_at(const struct log_pos *pos, size_t letter_idx,
+                     uint8_t *letter)
+{
+    unsigned lo = 0, hi = pos->num_epochs;
+
+    while (hi - lo > 1) { // last epoch that starts at or before the letter
+        unsigned mid = (lo + hi) / 2;
+        if (pos->letter_start[pos->epochs[mid].first_block] <= letter_idx)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    {
+        const struct epoch *epoch = &pos->epochs[lo];
+        size_t start = pos->letter_start[epoch->first_block];
+
+        if (!epoch->letters || letter_idx < start ||
+            letter_idx - start >= epoch->num_letters)
+            return -1;
+        *letter = epoch->letters[letter_idx - start];
+    }
+    return 0;
+}
+
+// Print the samples summarized by the block, from the decoded letters
+static void print_samples(const struct log_pos *pos, const struct log *log,
+                          unsigned block)
+{
+    size_t s, end = pos->sample_start[block] + log->blocks[block].summary.samples;
+    unsigned step = log->blocks[block].quant_step;
+
+    printf("  samples:");
+    for (s = pos->sample_start[block]; s < end; ++s) {
+        // The stream starts with a fixed '0' letter (see task_init), and
+        // the letters of a sample are in order from the least significant
+        size_t letter_idx = 1 + s * NUM_LETTERS_IN_SAMPLE;
+        uint32_t sample = 0;
+        unsigned i;
+
+        for (i = 0; i < NUM_LETTERS_IN_SAMPLE; ++i) {
+            uint8_t letter;
+            if (letter_at(pos, letter_idx + i, &letter)) {
+                printf(" ?"); // not offloaded yet, or not decodable
+                goto next;
+            }
+            sample |= (uint32_t)letter << (LETTER_SIZE_BITS * i);
+        }
+        printf(" %u", sample * step);
+next:
+        ;
+    }
+    printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+    struct predicate pred = { 0 };
+    struct query q = { 0 };
+    unsigned num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned blocks = 0, matched = 0, decoded = 0, unsummarized = 0;
+    unsigned indexed = 0;
+    unsigned i, j, e;
+    size_t bytes = 0;
+    double start, scan_time, decode_time = 0;
+    int decode = 0, opt, rc = 0;
+    unsigned char *match;
+    unsigned *match_start;
+
+    while ((opt = getopt(argc, argv, "a:b:xdj:h")) != -1) {
+        switch (opt) {
+            case 'a':
+                pred.above = 1;
+                if (parse_uint_arg(optarg, 0, &pred.max_above))
+                    goto bad_count;
+                break;
+            case 'b':
+                pred.below = 1;
+                if (parse_uint_arg(optarg, 0, &pred.min_below))
+                    goto bad_count;
+                break;
+            case 'x':
+                pred.crossings = 1;
+                break;
+            case 'd':
+                decode = 1;
+                break;
+            case 'j':
+                if (parse_uint_arg(optarg, 1, &num_threads))
+                    goto bad_count;
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+        continue;
+bad_count:
+        fprintf(stderr, "%s: -%c: invalid count: %s\n", argv[0], opt, optarg);
+        return 1;
+    }
+    if (optind == argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    q.num_logs = argc - optind;
+    q.logs = calloc(q.num_logs, sizeof(*q.logs));
+    q.pos = calloc(q.num_logs, sizeof(*q.pos));
+    q.from_index = calloc(q.num_logs, sizeof(*q.from_index));
+    match_start = calloc(q.num_logs + 1, sizeof(*match_start));
+    if (!q.logs || !q.pos || !q.from_index || !match_start) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    for (i = 0; i < q.num_logs; ++i) {
+        if (log_open(&q.logs[i], argv[optind + i]))
+            return 1;
+        bytes += q.logs[i].size;
+    }
+
+    start = now();
+
+    if (pool_run(num_threads, q.num_logs, index_job, &q)) {
+        fprintf(stderr, "failed to start the indexing threads\n");
+        return 1;
+    }
+
+    for (i = 0; i < q.num_logs; ++i) {
+        if (q.logs[i].error) {
+            fprintf(stderr, "%s: failed to index: %s\n", q.logs[i].name,
+                    q.logs[i].error);
+            rc = 1;
+        }
+        indexed += q.from_index[i];
+        match_start[i] = blocks;
+        blocks += q.logs[i].num_blocks;
+    }
+    match_start[q.num_logs] = blocks;
+    match = calloc(blocks + 1, 1);
+    if (!match) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    for (i = 0; i < q.num_logs; ++i) {
+        for (j = 0; j < q.logs[i].num_blocks; ++j) {
+            const struct block *b = &q.logs[i].blocks[j];
+            if (!b->has_summary)
+                unsummarized++;
+            if (matches(&pred, b)) {
+                match[match_start[i] + j] = 1;
+                matched++;
+            }
+        }
+    }
+
+    scan_time = now() - start;
+
+    if (decode && matched) {
+        start = now();
+
+        // A sample of a matching block may end in the next block
+        for (i = 0; i < q.num_logs; ++i) {
+            struct log_pos *pos = &q.pos[i];
+            unsigned *needed;
+
+            if (log_pos_init(pos, &q.logs[i])) {
+                fprintf(stderr, "out of memory\n");
+                return 1;
+            }
+            needed = calloc(pos->num_epochs + 1, sizeof(*needed));
+            if (!needed) {
+                fprintf(stderr, "out of memory\n");
+                return 1;
+            }
+            for (j = 0; j < q.logs[i].num_blocks; ++j) {
+                if (!match[match_start[i] + j])
+                    continue;
+                need_block(pos, j, needed);
+                if (j + 1 < q.logs[i].num_blocks)
+                    need_block(pos, j + 1, needed);
+            }
+            for (e = 0; e < pos->num_epochs; ++e) {
+                if (pos->epochs[e].incomplete)
+                    needed[e] = 0;
+                pos->epochs[e].num_blocks = needed[e];
+                decoded += needed[e];
+                if (needed[e])
+                    q.num_jobs++;
+            }
+            free(needed);
+        }
+
+        q.jobs = calloc(q.num_jobs + 1, sizeof(*q.jobs));
+        if (!q.jobs) {
+            fprintf(stderr, "out of memory\n");
+            return 1;
+        }
+        q.num_jobs = 0;
+        for (i = 0; i < q.num_logs; ++i)
+            for (e = 0; e < q.pos[i].num_epochs; ++e)
+                if (q.pos[i].epochs[e].num_blocks)
+                    q.jobs[q.num_jobs++] = &q.pos[i].epochs[e];
+
+        if (pool_run(num_threads, q.num_jobs, decode_job, &q)) {
+            fprintf(stderr, "failed to start the decoder threads\n");
+            return 1;
+        }
+
+        decode_time = now() - start;
+
+        for (j = 0; j < q.num_jobs; ++j) {
+            if (q.jobs[j]->error) {
+                fprintf(stderr, "%s: epoch %u: %s\n", q.jobs[j]->log->name,
+                        q.jobs[j]->log->blocks[q.jobs[j]->first_block].epoch,
+                        q.jobs[j]->error);
+                rc = 1;
+            }
+        }
+    }
+
+    for (i = 0; i < q.num_logs; ++i) {
+        for (j = 0; j < q.logs[i].num_blocks; ++j) {
+            const struct block *b = &q.logs[i].blocks[j];
+            const struct summary *s = &b->summary;
+
+            if (!match[match_start[i] + j])
+                continue;
+            printf("%s block %u: samples %u min %u max %u mean %u.%02u "
+                   "crossings %u of %u\n", q.logs[i].name, b->seq, s->samples,
+                   s->min, s->max, s->mean_x100 / 100, s->mean_x100 % 100,
+                   s->crossings, s->threshold);
+            if (decode)
+                print_samples(&q.pos[i], &q.logs[i], j);
+        }
+    }
+
+    fprintf(stderr, "scanned: %u blocks of %u devices (%.2f MB) in %.3f s, "
+            "%u from their index\n",
+            blocks, q.num_logs, bytes / 1e6, scan_time, indexed);
+    if (unsummarized)
+        fprintf(stderr, "blocks without summary: %u\n", unsummarized);
+    fprintf(stderr, "matched: %u blocks\n", matched);
+    if (decode)
+        fprintf(stderr, "decoded: %u blocks (%u epoch prefixes) in %.3f s\n",
+                decoded, q.num_jobs, decode_time);
+
+    for (i = 0; i < q.num_logs; ++i) {
+        if (decode && matched)
+            log_pos_free(&q.pos[i]);
+        log_close(&q.logs[i]);
+    }
+    free(q.jobs);
+    free(match);
+    free(match_start);
+    free(q.from_index);
+    free(q.pos);
+    free(q.logs);
+    return rc;
+}
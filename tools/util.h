@@ -0,0 +1,10 @@
+#ifndef UTIL_H
+#define UTIL_H
+
+// Monotonic time in seconds, for timing the runs
+double now(void);
+
+// Parse a decimal command line argument of at least min
+int parse_uint_arg(const char *arg, unsigned min, unsigned *value);
+
+#endif // UTIL_H